@@ -45,6 +45,7 @@ TelnetSpy::TelnetSpy() {
 	connected = false;
 	callbackConnect = NULL;
 	callbackDisconnect = NULL;
+	callbackWrite = NULL;
     callbackNvtBRK = NULL;
     callbackNvtIP = (void(*)()) 1;  // 1 => use ESP.restart;
     callbackNvtAO = (void(*)()) 1;  // 1 => use TelnetSpy.disconnectClient()
@@ -62,11 +63,33 @@ TelnetSpy::TelnetSpy() {
 	collectingTime = TELNETSPY_COLLECTING_TIME;
 	maxBlockSize = TELNETSPY_MAX_BLOCK_SIZE;
 	pingTime = TELNETSPY_PING_TIME;
-	pingRef = 0xFFFFFFFF;
-	waitRef = 0xFFFFFFFF;
-    nvtDetected = false;
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clients[i].cursor = 0;
+		clients[i].lag = 0;
+		clients[i].waitRef = 0xFFFFFFFF;
+		clients[i].pingRef = 0xFFFFFFFF;
+		clients[i].nvtDetected = false;
+		clients[i].nvtState = NVT_DATA;
+		clients[i].nvtCommand = 0;
+		clients[i].batch = TELNETSPY_MIN_BLOCK_SIZE;
+		clients[i].echoPending = false;
+		clients[i].connected = false;
+	}
 	telnetBuf = NULL;
+	lineRd = 0;
+	lineWr = 0;
+	droppedBytes = 0;
+	droppedLines = 0;
+	txPackets = 0;
+	txBytes = 0;
+	echoLatency = 0;
+	echoLatencyMax = 0;
+	blockBuf = NULL;
+	blockLen = 0;
 	bufLen = 0;
+	bufHead = 0;
+	bufTail = 0;
+	bufEvict = 0;
 	uint16_t size = TELNETSPY_BUFFER_LEN;
 	while (!setBufferSize(size)) {
 		size = size >> 1;
@@ -77,6 +100,8 @@ TelnetSpy::TelnetSpy() {
 	}
 	recBuf = NULL;
 	recLen = 0;
+	recHead = 0;
+	recTail = 0;
     setRecBufferSize(TELNETSPY_REC_BUFFER_LEN);
 	debugOutput = TELNETSPY_CAPTURE_OS_PRINT;
 	if (debugOutput) {
@@ -90,21 +115,14 @@ TelnetSpy::~TelnetSpy() {
 	if (rejectMsg) free(rejectMsg);
     if (filterMsg) free(filterMsg);
 	if (telnetBuf) free(telnetBuf);
+	if (blockBuf) free(blockBuf);
 	if (recBuf) free(recBuf);
 }
 
 void TelnetSpy::setPort(uint16_t portToUse) {
 	port = portToUse;
 	if (listening) {
-		if (client.connected()) {
-            sendBlock();
-			client.flush();
-			client.stop();
-		}
-		if (connected && (callbackDisconnect != NULL)) {
-			callbackDisconnect();
-		}
-		connected = false;
+		disconnectClient();
 		telnetServer->close();
 		delete telnetServer;
 		telnetServer = new WiFiServer(port);
@@ -145,6 +163,7 @@ void TelnetSpy::setRejectMsg(const String& msg) {
 
 void TelnetSpy::setMinBlockSize(uint16_t minSize) {
 	minBlockSize = min(max((uint16_t) 1, minSize), maxBlockSize);
+	clampBatches();
 }
     
 void TelnetSpy::setCollectingTime(uint16_t colTime) {
@@ -153,76 +172,61 @@ void TelnetSpy::setCollectingTime(uint16_t colTime) {
 
 void TelnetSpy::setMaxBlockSize(uint16_t maxSize) {
 	maxBlockSize = max(maxSize, minBlockSize);
+	clampBatches();
+}
+
+void TelnetSpy::clampBatches() {
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clients[i].batch = min(max(clients[i].batch, minBlockSize), maxBlockSize);
+	}
 }
 
 bool TelnetSpy::setBufferSize(uint16_t newSize) {
+	newSize = floorPow2(newSize);
 	if (telnetBuf && (bufLen == newSize)) {
 		return true;
 	}
 	if (newSize == 0) {
+CRITCAL_SECTION_START
 		bufLen = 0;
 		if (telnetBuf) {
 			free(telnetBuf);
 			telnetBuf = NULL;
 		}
+CRITCAL_SECTION_END
 		if (telnetServer) {
 			telnetServer->setNoDelay(false);
 		}
 		return true;
 	}
-	newSize = max(newSize, minBlockSize);
-	uint16_t oldBufLen = bufLen;
-	bufLen = newSize;
-	uint16_t tmp;
-	if (!telnetBuf || (bufUsed == 0)) {
-		bufRdIdx = 0;
-		bufWrIdx = 0;
-		bufUsed = 0;
-	} else {
-		if (bufLen < oldBufLen) {
-			if (bufRdIdx < bufWrIdx) {
-				if (bufWrIdx > bufLen) {
-					tmp = min(bufLen, (uint16_t) (bufWrIdx - max(bufLen, bufRdIdx)));
-					memcpy(telnetBuf, &telnetBuf[bufWrIdx - tmp], tmp);
-					bufWrIdx = tmp;
-					if (bufWrIdx > bufRdIdx) {
-						bufRdIdx = bufWrIdx;
-					} else {
-						if (bufRdIdx > bufLen) {
-							bufRdIdx = 0;
-						}
-					}
-					if (bufRdIdx == bufWrIdx) {
-						bufUsed = bufLen;
-					} else {
-						bufUsed = bufWrIdx - bufRdIdx;
-					}
-				}
-			} else {
-				if (bufWrIdx > bufLen) {
-					memcpy(telnetBuf, &telnetBuf[bufWrIdx - bufLen], bufLen);
-					bufRdIdx = 0;
-					bufWrIdx = 0;
-					bufUsed = bufLen;
-				} else {
-					tmp = min(bufLen - bufWrIdx, oldBufLen - bufRdIdx);
-					memcpy(&telnetBuf[bufLen - tmp], &telnetBuf[oldBufLen - tmp], tmp);
-					bufRdIdx = bufLen - tmp;
-					bufUsed = bufWrIdx + tmp;
-				}
-			}
-		}
-	}
-	char* temp = (char*) realloc(telnetBuf, bufLen);
+	newSize = max(newSize, floorPow2(minBlockSize));
+	char* temp = (char*) malloc(newSize);
 	if (!temp) {
 		return false;
 	}
+CRITCAL_SECTION_START
+	// Preserve the youngest data, linearized at the start of the new buffer
+	uint16_t used = 0;
+	if (telnetBuf) {
+		used = min(telnetUsed(), newSize);
+		uint32_t from = bufHead.load(std::memory_order_relaxed) - used;
+		for (uint16_t i = 0; i < used; i++) {
+			temp[i] = telnetBuf[(from + i) & (bufLen - 1)];
+		}
+		free(telnetBuf);
+	}
 	telnetBuf = temp;
-	if (telnetBuf && (bufLen > oldBufLen) && (bufRdIdx > bufWrIdx)) {
-		tmp = bufLen - (oldBufLen - bufRdIdx);
-		memcpy(&telnetBuf[tmp], &telnetBuf[bufRdIdx], oldBufLen - bufRdIdx);
-		bufRdIdx = tmp;
+	bufLen = newSize;
+	lineRd = 0;
+	lineWr = 0;
+	indexLines(temp, used, 0);
+	bufTail.store(0, std::memory_order_relaxed);
+	bufEvict.store(0, std::memory_order_relaxed);
+	bufHead.store(used, std::memory_order_release);
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clients[i].cursor = 0;
 	}
+CRITCAL_SECTION_END
 	if (telnetServer) {
 		telnetServer->setNoDelay(true);
 	}
@@ -246,14 +250,17 @@ bool TelnetSpy::getStoreOffline() {
 
 void TelnetSpy::setPingTime(uint16_t pngTime) {
 	pingTime = pngTime;
-	if (pingTime == 0) {
-		pingRef = 0xFFFFFFFF;
-	} else {
-		pingRef = (millis() & 0x7FFFFFF) + pingTime;
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if ((pingTime == 0) || !clients[i].connected) {
+			clients[i].pingRef = 0xFFFFFFFF;
+		} else {
+			clients[i].pingRef = (millis() & 0x7FFFFFF) + pingTime;
+		}
 	}
 }
 
 bool TelnetSpy::setRecBufferSize(uint16_t newSize) {
+	newSize = floorPow2(newSize);
 	if (recBuf && (recLen == newSize)) {
 		return true;
 	}
@@ -270,9 +277,8 @@ bool TelnetSpy::setRecBufferSize(uint16_t newSize) {
 		return false;
     }
     recLen = newSize;
-	recRdIdx = 0;
-	recWrIdx = 0;
-	recUsed = 0;
+	recHead = 0;
+	recTail = 0;
 	return true;
 }
 
@@ -288,53 +294,47 @@ void TelnetSpy::setSerial(HardwareSerial* usedSerial) {
 }
 
 size_t TelnetSpy::write (uint8_t data) {
+	return write(&data, 1);
+}
+
+size_t TelnetSpy::write (const uint8_t* data, size_t len) {
+	if (callbackWrite != NULL) {
+		callbackWrite(data, len);
+	}
 	if (telnetBuf) {
-		if (storeOffline || client.connected()) {
-			if (bufUsed == bufLen) {
-				if (client.connected()) {
+		if (storeOffline || connected) {
+			const char* src = (const char*) data;
+			size_t n = len;
+			if (n > bufLen) {
+				// Only the youngest part of the span fits into the buffer
+				src += n - bufLen;
+				n = bufLen;
+			}
+			if ((size_t) (bufLen - telnetUsed()) < n) {
+				if (connected) {
 					sendBlock();
 				}
-				if (bufUsed == bufLen) {
-					char c;
-					while (bufUsed > 0) {
-						c = pullTelnetBuf();
-						if (c == '\n') {
-							break;
-						}
-					}
-					if (peekTelnetBuf() == '\r') {
-						pullTelnetBuf();
-					}
-				}
 			}
-			addTelnetBuf(data);
+			addTelnetBuf(src, n);
 		}
 	} else {
-		if (client.connected()) {
-			client.write(data);
+		for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+			if (clients[i].connected) {
+				clients[i].client.write(data, len);
+			}
 		}
 	}
 	if (usedSer) {
-		return usedSer->write(data);
+		return usedSer->write(data, len);
 	}
-	return 1;
+	return len;
 }
 
 void TelnetSpy::debugWrite (uint8_t data) {
+	// May be entered from any task or from interrupt context, so only the
+	// producer side of the ring is touched
 	if (telnetBuf) {
-		if (storeOffline || client.connected()) {
-			if (bufUsed == bufLen) {
-				char c;
-				while (bufUsed > 0) {
-					c = pullTelnetBuf();
-					if (c == '\n') {
-						break;
-					}
-				}
-				if (peekTelnetBuf() == '\r') {
-					pullTelnetBuf();
-				}
-			}
+		if (storeOffline || connected) {
 			addTelnetBuf(data);
 		}
 	}
@@ -352,7 +352,7 @@ int TelnetSpy::available (void) {
 			return avail;
 		}
 	}
-	if (client.connected()) {
+	if (connected) {
 		return telnetAvailable();
 	}
 	return 0;
@@ -366,22 +366,23 @@ int TelnetSpy::read (void) {
 			return val;
 		}
 	}
-	if (client.connected()) {
+	if (connected) {
 		if (telnetAvailable()) {
             if (recBuf) {
-                if (recUsed == 0) {
+                uint16_t tail = recTail.load(std::memory_order_relaxed);
+                if (recHead.load(std::memory_order_acquire) == tail) {
                     val = -1;
                 } else {
-CRITCAL_SECTION_START
-                    val = recBuf[recRdIdx++];
-	                if (recRdIdx >= recLen) {
-		                recRdIdx = 0;
-	                }
-	                recUsed--;
-CRITCAL_SECTION_END
+                    val = (uint8_t) recBuf[tail & (recLen - 1)];
+                    recTail.store(tail + 1, std::memory_order_release);
                 }
             } else {
-			    val = client.read();
+                // Without a receive buffer the first client with pending input is read
+                for (int i = 0; (i < TELNETSPY_MAX_CLIENTS) && (val == -1); i++) {
+                    if (clients[i].connected && clients[i].client.available()) {
+                        val = clients[i].client.read();
+                    }
+                }
             }
 		}
 	}
@@ -396,12 +397,16 @@ int TelnetSpy::peek (void) {
 			return val;
 		}
 	}
-	if (client.connected()) {
+	if (connected) {
 		if (telnetAvailable()) {
             if (recBuf) {
-                val = recBuf[recRdIdx];
+                val = (uint8_t) recBuf[recTail.load(std::memory_order_relaxed) & (recLen - 1)];
             } else {
-			    val = client.peek();
+                for (int i = 0; (i < TELNETSPY_MAX_CLIENTS) && (val == -1); i++) {
+                    if (clients[i].connected && clients[i].client.available()) {
+                        val = clients[i].client.peek();
+                    }
+                }
             }
 		}
 	}
@@ -412,9 +417,13 @@ void TelnetSpy::flush (void) {
 	if (usedSer) {
 		usedSer->flush();
 	}
-	if (client.connected()) {
+	if (connected) {
         sendBlock();
-        client.flush();
+		for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+			if (clients[i].connected) {
+				clients[i].client.flush();
+			}
+		}
     }
 }
 
@@ -447,15 +456,7 @@ void TelnetSpy::end() {
 	if (usedSer) {
 		usedSer->end();
 	}
-	if (client.connected()) {
-        sendBlock();
-		client.flush();
-		client.stop();
-	}
-	if (connected && (callbackDisconnect != NULL)) {
-		callbackDisconnect();
-	}	
-	connected = false;
+	disconnectClient();
 	telnetServer->close();
 	delete telnetServer;
 	telnetServer = NULL;
@@ -501,9 +502,9 @@ bool TelnetSpy::isRxEnabled(void) {
 
 int TelnetSpy::availableForWrite(void) {
 	if (usedSer) {
-		return min(usedSer->availableForWrite(), bufLen - bufUsed);
+		return min(usedSer->availableForWrite(), bufLen - telnetUsed());
 	}
-	return bufLen - bufUsed;
+	return bufLen - telnetUsed();
 }
 
 TelnetSpy::operator bool() const {
@@ -539,93 +540,306 @@ uint32_t TelnetSpy::baudRate(void) {
 	return 115200;
 }
 
-void TelnetSpy::sendBlock() {
-CRITCAL_SECTION_START
-	uint16_t len = bufUsed;
-	if (len > maxBlockSize) {
-		len = maxBlockSize;
+uint16_t TelnetSpy::floorPow2(uint16_t n) {
+	// Ring indices run freely over 16 bits, so at most 2^15 bytes
+	uint16_t p = 0x8000;
+	while (p > n) {
+		p >>= 1;
 	}
-	len = min(len, (uint16_t) (bufLen - bufRdIdx));
-	uint16_t idx = bufRdIdx;
-CRITCAL_SECTION_END
-    if (len == 0) {
-        return;
-    }
-	client.write(&telnetBuf[idx], len);
-CRITCAL_SECTION_START
-	bufRdIdx += len;
-	if (bufRdIdx >= bufLen) {
-		bufRdIdx = 0;
+	return p;
+}
+
+uint32_t TelnetSpy::telnetStart() {
+	// The oldest valid byte: the consumer's tail unless the producer evicted past it
+	uint32_t tail = bufTail.load(std::memory_order_acquire);
+	uint32_t evict = bufEvict.load(std::memory_order_acquire);
+	return ((int32_t) (evict - tail) > 0) ? evict : tail;
+}
+
+uint16_t TelnetSpy::telnetUsed() {
+	return bufHead.load(std::memory_order_acquire) - telnetStart();
+}
+
+bool TelnetSpy::claimSender() {
+	// write() may flush from another task, so the consumer is claimed first
+	if (!telnetBuf || sending.test_and_set(std::memory_order_acquire)) {
+		return false;
 	}
-	bufUsed -= len;
-	if (bufUsed == 0) {
-		bufRdIdx = 0;
-		bufWrIdx = 0;
+	if (blockLen != maxBlockSize) {
+		char* temp = (char*) realloc(blockBuf, maxBlockSize);
+		if (temp) {
+			blockBuf = temp;
+			blockLen = maxBlockSize;
+		}
 	}
-CRITCAL_SECTION_END
-	waitRef = 0xFFFFFFFF;
-	if (pingRef != 0xFFFFFFFF) {
-		pingRef = (millis() & 0x7FFFFFF) + pingTime;
-		if (pingRef > 0x7FFFFFFF) {
-			pingRef -= 0x80000000;
+	return true;
+}
+
+void TelnetSpy::releaseSender() {
+	// The ring's tail follows the slowest connected client. Without any client
+	// it stays where it is, so data stored offline is kept.
+	uint32_t head = bufHead.load(std::memory_order_acquire);
+	uint32_t behind = 0;
+	bool any = false;
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (clients[i].connected && (!any || ((uint32_t) (head - clients[i].cursor) > behind))) {
+			behind = head - clients[i].cursor;
+			any = true;
 		}
 	}
+	if (any) {
+		bufTail.store(head - behind, std::memory_order_release);
+	}
+	sending.clear(std::memory_order_release);
 }
 
-void TelnetSpy::addTelnetBuf(char c) {
-CRITCAL_SECTION_START
-	telnetBuf[bufWrIdx] = c;
-	if (bufUsed == bufLen) {
-		bufRdIdx++;
-		if (bufRdIdx >= bufLen) {
-			bufRdIdx = 0;
+void TelnetSpy::sendBlock() {
+	if (!claimSender()) {
+		return;
+	}
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (clients[i].connected) {
+			sendClientBlock(clients[i]);
 		}
-	} else {
-		bufUsed++;
 	}
-	bufWrIdx++;
-	if (bufWrIdx >= bufLen) {
-		bufWrIdx = 0;
+	releaseSender();
+}
+
+void TelnetSpy::sendBlock(TelnetSpyClient& c) {
+	if (!claimSender()) {
+		return;
 	}
-CRITCAL_SECTION_END
+	sendClientBlock(c);
+	releaseSender();
 }
 
-char TelnetSpy::pullTelnetBuf() {
-	if (bufUsed == 0) {
-		return 0;
+uint16_t TelnetSpy::skipClient(TelnetSpyClient& c, uint32_t skipped) {
+	char gap[TELNETSPY_GAP_LEN];
+	int n = snprintf(gap, sizeof(gap), TELNETSPY_GAP_MSG, (unsigned int) skipped);
+	n = min(n, (int) sizeof(gap) - 1);
+	c.lag += skipped;
+	return c.client.write((const uint8_t*) gap, n);
+}
+
+void TelnetSpy::sendClientBlock(TelnetSpyClient& c) {
+	// Consumer side: only the client's cursor is written here, no critical
+	// section needed. Data dropped by the producers before it was sent to this
+	// client is skipped and replaced by a gap marker.
+	// One write per call: both segments of a wrapped ring are gathered into
+	// the block, limited to what the socket can take right now, so nothing
+	// is split into extra small packets or left half written.
+	size_t window = blockLen + TELNETSPY_GAP_LEN;
+#ifdef ESP8266
+	// the ESP32 WiFiClient does not report its send window
+	window = c.client.availableForWrite();
+#endif
+	if (window < TELNETSPY_GAP_LEN) {
+		// Wait until there is room for a gap marker, too
+		return;
 	}
-CRITCAL_SECTION_START
-	char c = telnetBuf[bufRdIdx++]; 
-	if (bufRdIdx >= bufLen) {
-		bufRdIdx = 0;
+	uint32_t start = c.cursor;
+	uint32_t evict = bufEvict.load(std::memory_order_acquire);
+	if ((int32_t) (evict - start) > 0) {
+		window -= skipClient(c, evict - start);
+		start = evict;
+		c.cursor = evict;
+	}
+	uint16_t len = min((uint32_t) (bufHead.load(std::memory_order_acquire) - start), (uint32_t) blockLen);
+	len = min((size_t) len, window);
+	if (len == 0) {
+		return;
+	}
+	// Copy the block out, then check whether a producer evicted (and so may
+	// have overwritten) its beginning meanwhile. Bytes past the drop point
+	// are never touched by the producers.
+	uint16_t idx = start & (bufLen - 1);
+	uint16_t first = min(len, (uint16_t) (bufLen - idx));
+	memcpy(blockBuf, &telnetBuf[idx], first);
+	if (len > first) {
+		memcpy(&blockBuf[first], telnetBuf, len - first);
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	evict = bufEvict.load(std::memory_order_relaxed);
+	uint16_t skip = 0;
+	if ((int32_t) (evict - start) > 0) {
+		if (window < TELNETSPY_GAP_LEN) {
+			// No room for the marker; the next call starts with it
+			return;
+		}
+		window -= skipClient(c, evict - start);
+		if ((uint32_t) (evict - start) >= len) {
+			c.cursor = evict;
+			return;
+		}
+		skip = evict - start;
+	}
+	// The socket may take less than offered, the rest goes next time
+	size_t sent = c.client.write((const uint8_t*) &blockBuf[skip], min((size_t) (len - skip), window));
+	c.cursor = start + skip + sent;
+	if (sent > 0) {
+		txPackets++;
+		txBytes += sent;
+	}
+	if (c.echoPending) {
+		uint16_t latency = min(millis() - c.echoRef, 0xFFFFUL);
+		echoLatency = echoLatency ? (echoLatency * 7 + latency) / 8 : latency;
+		echoLatencyMax = max(echoLatencyMax, latency);
+		c.echoPending = false;
+	}
+	c.waitRef = 0xFFFFFFFF;
+	if (c.pingRef != 0xFFFFFFFF) {
+		c.pingRef = (millis() & 0x7FFFFFF) + pingTime;
+		if (c.pingRef > 0x7FFFFFFF) {
+			c.pingRef -= 0x80000000;
+		}
 	}
-	bufUsed--;
-CRITCAL_SECTION_END
-	return c;
 }
 
-char TelnetSpy::peekTelnetBuf() {
-	if (bufUsed == 0) {
-		return 0;
+void TelnetSpy::addTelnetBuf(char c) {
+	addTelnetBuf(&c, 1);
+}
+
+void TelnetSpy::addTelnetBuf(const char* data, uint16_t len) {
+	if ((len == 0) || !telnetBuf) {
+		return;
 	}
+	// Producer side: several producers (loop, os_printf, ISRs) may race here
 CRITCAL_SECTION_START
-    char c = telnetBuf[bufRdIdx];
+	if ((uint16_t) (bufLen - telnetUsed()) < len) {
+		freeTelnetBuf(len);
+	}
+	uint32_t head = bufHead.load(std::memory_order_relaxed);
+	uint16_t idx = head & (bufLen - 1);
+	uint16_t first = min(len, (uint16_t) (bufLen - idx));
+	memcpy(&telnetBuf[idx], data, first);
+	if (len > first) {
+		memcpy(telnetBuf, &data[first], len - first);
+	}
+	indexLines(data, len, head);
+	bufHead.store(head + len, std::memory_order_release);
 CRITCAL_SECTION_END
-    return c;
+}
+
+void TelnetSpy::indexLines(const char* data, uint16_t len, uint32_t pos) {
+	// Remember where lines start, so eviction can jump by whole lines. When
+	// the index is full, the starts at or before telnetStart() are dropped
+	// first: that data is sent or evicted already, no eviction needs them.
+	// If it is still full every other entry is given up. Each halving thins
+	// out everything indexed so far, so a region that went through k of them
+	// is indexed every 2^k lines and an eviction there may drop up to
+	// 2^k - 1 lines more than needed. Evictions use up the oldest, coarsest
+	// entries first. Amortized this is O(1) per line.
+	const char* end = data + len;
+	for (const char* p = data; (p = (const char*) memchr(p, '\n', end - p)) != NULL; p++) {
+		if ((uint8_t) (lineWr - lineRd) >= TELNETSPY_LINE_INDEX) {
+			uint32_t start = telnetStart();
+			while ((lineRd != lineWr) && ((int32_t) (lineStart[lineRd % TELNETSPY_LINE_INDEX] - start) <= 0)) {
+				lineRd++;
+			}
+		}
+		if ((uint8_t) (lineWr - lineRd) >= TELNETSPY_LINE_INDEX) {
+			for (uint8_t i = 0; i < TELNETSPY_LINE_INDEX / 2; i++) {
+				lineStart[(uint8_t) (lineRd + i) % TELNETSPY_LINE_INDEX] =
+					lineStart[(uint8_t) (lineRd + 2 * i + 1) % TELNETSPY_LINE_INDEX];
+			}
+			lineWr = lineRd + TELNETSPY_LINE_INDEX / 2;
+		}
+		lineStart[lineWr++ % TELNETSPY_LINE_INDEX] = pos + (p - data) + 1;
+	}
+}
+
+void TelnetSpy::freeTelnetBuf(uint16_t needed) {
+	// Drop whole lines from the oldest end until <needed> bytes are free. The
+	// consumer's tail is left alone, the drop point is published via bufEvict.
+	// The line index makes this O(lines dropped); without a usable line start
+	// (one line longer than the buffer) it cuts exactly as far as needed.
+	uint32_t head = bufHead.load(std::memory_order_relaxed);
+	uint32_t start = telnetStart();
+	uint32_t target = head + min(needed, bufLen) - bufLen;
+	if ((int32_t) (target - start) <= 0) {
+		return;
+	}
+	uint32_t evict = target;
+	while (lineRd != lineWr) {
+		uint32_t line = lineStart[lineRd % TELNETSPY_LINE_INDEX];
+		if ((int32_t) (line - start) > 0) {
+			// A line that held unsent data
+			droppedLines++;
+		}
+		lineRd++;
+		if ((int32_t) (line - target) >= 0) {
+			evict = line;
+			break;
+		}
+	}
+	droppedBytes += evict - start;
+	bufEvict.store(evict, std::memory_order_relaxed);
+	// Publish the drop point before the caller overwrites the dropped bytes
+	std::atomic_thread_fence(std::memory_order_release);
 }
 
 int TelnetSpy::telnetAvailable() {
     checkReceive();
     if (recBuf) {
-        return recUsed;
+        return (uint16_t) (recHead.load(std::memory_order_acquire) - recTail.load(std::memory_order_relaxed));
     }
-	return client.available();
+	int avail = 0;
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (clients[i].connected) {
+			avail += clients[i].client.available();
+		}
+	}
+	return avail;
 }
 
 bool TelnetSpy::isClientConnected() {
 	return connected;
 }
 
+uint8_t TelnetSpy::getClientCount() {
+	uint8_t count = 0;
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (clients[i].connected) {
+			count++;
+		}
+	}
+	return count;
+}
+
+uint32_t TelnetSpy::getDroppedBytes() {
+	return droppedBytes;
+}
+
+uint32_t TelnetSpy::getDroppedLines() {
+	return droppedLines;
+}
+
+uint16_t TelnetSpy::getPacketsPerKB() {
+	if (txBytes == 0) {
+		return 0;
+	}
+	return (uint16_t) ((txPackets * 1024ULL + txBytes / 2) / txBytes);
+}
+
+uint16_t TelnetSpy::getEchoLatency() {
+	return echoLatency;
+}
+
+uint16_t TelnetSpy::getEchoLatencyMax() {
+	return echoLatencyMax;
+}
+
+uint32_t TelnetSpy::getClientLag(uint8_t idx) {
+	if (idx >= TELNETSPY_MAX_CLIENTS) {
+		return 0;
+	}
+	return clients[idx].lag;
+}
+
+void TelnetSpy::updateConnected() {
+	connected = getClientCount() > 0;
+}
+
 void TelnetSpy::setCallbackOnConnect(void (*callback)()) {
 	callbackConnect = callback;
 }
@@ -634,22 +848,44 @@ void TelnetSpy::setCallbackOnDisconnect(void (*callback)()) {
 	callbackDisconnect = callback;
 }
 
-void TelnetSpy::disconnectClient() {
-    if (client.connected()) {
-        sendBlock();
-        client.flush();
-        client.stop();
+void TelnetSpy::setCallbackOnWrite(void (*callback)(const uint8_t* data, size_t len)) {
+	callbackWrite = callback;
+}
+
+void TelnetSpy::dropClient(TelnetSpyClient& c) {
+    if (c.client.connected()) {
+        sendBlock(c);
+        c.client.flush();
+        c.client.stop();
     }
-    if (connected && (callbackDisconnect != NULL)) {
-        callbackDisconnect();
+	c.pingRef = 0xFFFFFFFF;
+	c.waitRef = 0xFFFFFFFF;
+    if (c.connected) {
+		c.connected = false;
+		updateConnected();
+		if (callbackDisconnect != NULL) {
+			callbackDisconnect();
+		}
     }
-    connected = false;
+}
+
+void TelnetSpy::disconnectClient() {
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		dropClient(clients[i]);
+	}
 }
 
 void TelnetSpy::clearBuffer() {
-	bufUsed = 0;
-	bufRdIdx = 0;
-	bufWrIdx = 0;
+CRITCAL_SECTION_START
+	uint32_t head = bufHead.load(std::memory_order_relaxed);
+	bufEvict.store(head, std::memory_order_relaxed);
+	bufTail.store(head, std::memory_order_release);
+	lineRd = lineWr;
+CRITCAL_SECTION_END
+	// Discarded data is not reported as a gap
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		clients[i].cursor = head;
+	}
 }
 
 void TelnetSpy::setFilter(char ch, const char* msg, void (*callback)()) {
@@ -736,7 +972,14 @@ void TelnetSpy::handle() {
 		listening = true;
 	}
     if (telnetServer->hasClient()) {
-        if (client.connected()) {
+        TelnetSpyClient* slot = NULL;
+        for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+            if (!clients[i].connected && !clients[i].client.connected()) {
+                slot = &clients[i];
+                break;
+            }
+        }
+        if (slot == NULL) {
             WiFiClient rejectClient = telnetServer->accept();
 			if (strlen(rejectMsg) > 0) {
 				rejectClient.write((const uint8_t*) rejectMsg, strlen(rejectMsg));
@@ -744,209 +987,299 @@ void TelnetSpy::handle() {
 			rejectClient.flush();
             rejectClient.stop();
         } else {
-            client = telnetServer->accept();
+            slot->client = telnetServer->accept();
+            // A new client starts with whatever is still waiting in the buffer.
+            // If data stored offline was dropped meanwhile it gets the marker.
+            slot->cursor = telnetBuf ? bufTail.load(std::memory_order_acquire) : 0;
+            slot->lag = 0;
+            slot->batch = minBlockSize;
+            slot->echoPending = false;
+            slot->nvtDetected = false;
+            slot->nvtState = NVT_DATA;
+            slot->waitRef = 0xFFFFFFFF;
 			if (strlen(welcomeMsg) > 0) {
-				client.write((const uint8_t*) welcomeMsg, strlen(welcomeMsg));
+				slot->client.write((const uint8_t*) welcomeMsg, strlen(welcomeMsg));
 			}
         }
     }
-    if (client.connected()) {
-    	if (!connected) {
-    		connected = true;
-    		if (pingTime != 0) {
-    			pingRef = (millis() & 0x7FFFFFF) + pingTime;
-    		}
-			if (callbackConnect != NULL) {
-				callbackConnect();
-			}
-		}
-	} else {
-    	if (connected) {
-    		connected = false;
-            sendBlock();
-        	client.flush();
-            client.stop();
-			pingRef = 0xFFFFFFFF;
-			waitRef = 0xFFFFFFFF;
-			if (callbackDisconnect != NULL) {
-				callbackDisconnect();
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		TelnetSpyClient& c = clients[i];
+		if (c.client.connected()) {
+			if (!c.connected) {
+				c.connected = true;
+				updateConnected();
+				if (pingTime != 0) {
+					c.pingRef = (millis() & 0x7FFFFFF) + pingTime;
+				}
+				if (callbackConnect != NULL) {
+					callbackConnect();
+				}
 			}
+		} else if (c.connected) {
+			dropClient(c);
 		}
 	}
 
-	if (client.connected() && (bufUsed > 0)) {
-		if (bufUsed >= minBlockSize) {
-			sendBlock();
-		} else {
-			unsigned long m = millis() & 0x7FFFFFF;
-			if (waitRef == 0xFFFFFFFF) {
-				waitRef = m + collectingTime;
-				if (waitRef > 0x7FFFFFFF) {
-					waitRef -= 0x80000000;
-				}
+	uint32_t head = telnetBuf ? bufHead.load(std::memory_order_acquire) : 0;
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		TelnetSpyClient& c = clients[i];
+		if (!c.connected) {
+			continue;
+		}
+		uint32_t pending = head - c.cursor;
+		if (pending > 0) {
+			if (c.echoPending) {
+				// Input was received from this client, its echo goes out at once
+				sendBlock(c);
+			} else if (pending >= c.batch) {
+				// Sustained output: the next batch may be larger
+				sendBlock(c);
+				c.batch = min((uint16_t) (c.batch * 2), maxBlockSize);
 			} else {
-				if (!((waitRef < 0x20000000) && (m > 0x60000000)) && (m >= waitRef)) {
-					sendBlock();
+				unsigned long m = millis() & 0x7FFFFFF;
+				if (c.waitRef == 0xFFFFFFFF) {
+					c.waitRef = m + collectingTime;
+					if (c.waitRef > 0x7FFFFFFF) {
+						c.waitRef -= 0x80000000;
+					}
+				} else {
+					if (!((c.waitRef < 0x20000000) && (m > 0x60000000)) && (m >= c.waitRef)) {
+						// Output slowed down, collect less before sending
+						sendBlock(c);
+						c.batch = max((uint16_t) (c.batch / 2), minBlockSize);
+					}
 				}
 			}
+		} else if (c.echoPending && ((millis() - c.echoRef) >= collectingTime)) {
+			// The input did not produce any output
+			c.echoPending = false;
 		}
-	}
-	if (client.connected() && (pingRef != 0xFFFFFFFF)) {
-		unsigned long m = millis() & 0x7FFFFFF;
-		if (!((pingRef < 0x20000000) && (m > 0x60000000)) && (m >= pingRef)) {
-            if (nvtDetected) {
-                // Send a NOP via telnet NVT protocol
-			    addTelnetBuf(255);
-			    addTelnetBuf(241);
-            } else  {
-                // Send a NULL
-			    addTelnetBuf(0);
-            }
-			sendBlock();
+		if (c.pingRef != 0xFFFFFFFF) {
+			unsigned long m = millis() & 0x7FFFFFF;
+			// A write() in another task may be sending right now, the ping must
+			// not interleave with its block; it is tried again on the next call
+			if (!((c.pingRef < 0x20000000) && (m > 0x60000000)) && (m >= c.pingRef) && (!telnetBuf || claimSender())) {
+				if (c.nvtDetected) {
+					// Send a NOP via telnet NVT protocol
+					const uint8_t nop[] = { 255, 241 };
+					c.client.write(nop, sizeof(nop));
+				} else  {
+					// Send a NULL
+					const uint8_t nul = 0;
+					c.client.write(&nul, 1);
+				}
+				c.pingRef = (millis() & 0x7FFFFFF) + pingTime;
+				if (c.pingRef > 0x7FFFFFFF) {
+					c.pingRef -= 0x80000000;
+				}
+				if (telnetBuf) {
+					releaseSender();
+				}
+			}
 		}
 	}
-    if (client.connected()) {
+    if (connected) {
         checkReceive();
     }
 }
 
-void TelnetSpy::writeRecBuf(char c) {
-    if (recLen == recUsed) {
-        return;
-    }
-CRITCAL_SECTION_START
-	recBuf[recWrIdx++] = c;
-	if (recWrIdx >= recLen) {
-		recWrIdx = 0;
+void TelnetSpy::writeRecBuf(const char* data, uint16_t len) {
+	// Single producer (checkReceive) / single consumer (read), lock free
+	uint16_t head = recHead.load(std::memory_order_relaxed);
+	uint16_t space = recLen - (uint16_t) (head - recTail.load(std::memory_order_acquire));
+	if (len > space) {
+		// checkReceive() reads no more than fits, this is only a guard
+		len = space;
 	}
-	recUsed++;
-CRITCAL_SECTION_END
+	if (len == 0) {
+		return;
+	}
+	uint16_t pos = head & (recLen - 1);
+	uint16_t first = min(len, (uint16_t) (recLen - pos));
+	memcpy(&recBuf[pos], data, first);
+	memcpy(recBuf, data + first, len - first);
+	recHead.store(head + len, std::memory_order_release);
 }
 
 void TelnetSpy::checkReceive() {
-	int n = client.available();
-	while (n > 0) {
-        char c, c2;
-        c = client.peek();
-        if (filterChar && (filterChar == c)) {
-            // Filter character detected
-			if (strlen(filterMsg) > 0) {
-				client.write((const uint8_t*) filterMsg, strlen(filterMsg));
+	for (int i = 0; i < TELNETSPY_MAX_CLIENTS; i++) {
+		if (clients[i].connected) {
+			checkReceive(clients[i]);
+		}
+	}
+}
+
+void TelnetSpy::checkReceive(TelnetSpyClient& from) {
+	WiFiClient& client = from.client;
+	uint8_t block[TELNETSPY_REC_BLOCK_LEN];
+	while (true) {
+		int n = client.available();
+		if (n <= 0) {
+			return;
+		}
+		if (recBuf) {
+			// Never take more than recBuf can hold, the rest waits in the
+			// TCP receive window until read() made room (NVT bytes are
+			// consumed here, so the data bytes of a block always fit)
+			uint16_t space = recLen - (uint16_t) (recHead.load(std::memory_order_relaxed) - recTail.load(std::memory_order_acquire));
+			if (space == 0) {
+				return;
 			}
-   			client.read();  // Remove filter character
-            n--;
-            if (filterCallback != NULL) {
-                filterCallback();
-            }
-            continue;
-        }
-		if (255 == c) {  // If IAC (start of telnet NVT protocol telegram):
-            if (n == 1) {
-                // Telegram incomplete
-                return;
-            }
-   			client.read();  // Remove IAC
-            n--;
-            c = client.read();  // Gett command byte
-            n--;
-            switch (c) {
-                case 241:   // Telnet command "NOP" (no operation)
-              		if (pingTime != 0) {
-  		            	pingRef = (millis() & 0x7FFFFFF) + pingTime;
-  		            }
-                    break;
-                case 242:   // Telnet command "Data Mark" (not yet implemented)
-                    break;
-                case 243:   // Telnet command "Break";
-                    if (callbackNvtBRK != NULL) {
-                        callbackNvtBRK();
-                    }
-                    break;
-                case 244:   // Telnet command "Interrupt process"
-                    if (callbackNvtIP != NULL) {
-                        if ((void(*)()) 1 == callbackNvtIP) {
-                            ESP.restart();
-                        } else {
-                            callbackNvtIP();
-                        }
-                    }
-                    break;
-                case 245:   // Telnet command "Abort output"
-                    if (callbackNvtAO != NULL) {
-                        if ((void(*)()) 1 == callbackNvtAO) {
-                            disconnectClient();
-                        } else {
-                            callbackNvtAO();
-                        }
-                    }
-                    break;
-                case 246:   // Telnet command "Are you there"
-                    if (callbackNvtAYT != NULL) {
-                        callbackNvtAYT();
-                    }
-                    break;
-                case 247:   // Telnet command "Erase character"
-                    if (callbackNvtEC != NULL) {
-                        callbackNvtEC();
-                    }
-                    break;
-                case 248:   // Telnet command "Erase line"
-                    if (callbackNvtEL != NULL) {
-                        callbackNvtEL();
-                    }
-                    break;
-                case 249:   // Telnet command "Go ahead"
-                    if (callbackNvtGA != NULL) {
-                        callbackNvtGA();
-                    }
-                    break;
-                case 250:   // Telnet command "SB" (additional data follows)
-                    while (n > 0) {
-                        c = client.read();
-                        n--;
-                        if (255 != c) {
-                            // If not IAC, ignore it
-                            continue;
-                        }
-                        c = client.read();
-                        n--;
-                        if (240 != c) {
-                            // If not SE (end of additional data), ignore it
-                            continue;
-                        }
-                    }
-                    break;
-                case 251:   // Telnet command "WILL"
-                case 252:   // Telnet command "WON'T"
-                case 253:   // Telnet command "DO"
-                case 254:   // Telnet command "DON'T"
-                    nvtDetected = true;
-                    c2 = client.read();     // Get option byte
-                    n--;
-                    if (callbackNvtWWDD != NULL) {
-                        callbackNvtWWDD(c, c2);
-                    }
-                    break;
-                case 255:   // Escaped data byte 0xff
-                    if (recBuf) {
-                        writeRecBuf(c);
-                    } else {
-                        // If no receive buffer is used, the data byte 0xff will be lost.
-                        // May be in the future there is a solution for this problem.
-                    }
-                    break;
-            }
-            continue;
-		}
-        // Next character in the client buffer is a normal character
-        if (recBuf) {
-            client.read();
-            writeRecBuf(c);
-            n--;
-            continue;
-        }
-        // Leave the character in the client buffer
-        return;
+			n = min(n, min((int) sizeof(block), (int) space));
+		} else {
+			// Without a receive buffer the data bytes stay in the client for
+			// read(), only NVT telegrams and the filter character are taken
+			if (from.nvtState == NVT_DATA) {
+				int c = client.peek();
+				if ((c != 255) && !(filterChar && ((char) c == filterChar))) {
+					return;
+				}
+			}
+			n = 1;
+		}
+		n = client.read(block, n);
+		if (n <= 0) {
+			return;
+		}
+		if (!parseReceived(from, block, n)) {
+			// The client was dropped
+			return;
+		}
 	}
 }
 
+bool TelnetSpy::parseReceived(TelnetSpyClient& from, const uint8_t* data, int len) {
+	// Single pass over the block. The state is kept per client, so telegrams
+	// split across TCP segments are continued with the next block.
+	int run = 0;    // start of the pending data bytes
+	uint16_t recStart = recHead.load(std::memory_order_relaxed);
+	for (int i = 0; i < len; i++) {
+		uint8_t c = data[i];
+		switch (from.nvtState) {
+			case NVT_DATA:
+				if ((c != 255) && !(filterChar && ((char) c == filterChar))) {
+					continue;
+				}
+				if (recBuf && (i > run)) {
+					writeRecBuf((const char*) &data[run], i - run);
+				}
+				run = i + 1;
+				if (c == 255) {     // IAC (start of telnet NVT protocol telegram)
+					from.nvtState = NVT_IAC;
+					break;
+				}
+				// Filter character detected
+				if (strlen(filterMsg) > 0) {
+					from.client.write((const uint8_t*) filterMsg, strlen(filterMsg));
+				}
+				if (filterCallback != NULL) {
+					filterCallback();
+				}
+				break;
+			case NVT_IAC:
+				run = i + 1;
+				from.nvtState = NVT_DATA;
+				switch (c) {
+					case 241:   // Telnet command "NOP" (no operation)
+						if (pingTime != 0) {
+							from.pingRef = (millis() & 0x7FFFFFF) + pingTime;
+						}
+						break;
+					case 242:   // Telnet command "Data Mark" (not yet implemented)
+						break;
+					case 243:   // Telnet command "Break";
+						if (callbackNvtBRK != NULL) {
+							callbackNvtBRK();
+						}
+						break;
+					case 244:   // Telnet command "Interrupt process"
+						if (callbackNvtIP != NULL) {
+							if ((void(*)()) 1 == callbackNvtIP) {
+								ESP.restart();
+							} else {
+								callbackNvtIP();
+							}
+						}
+						break;
+					case 245:   // Telnet command "Abort output"
+						if (callbackNvtAO != NULL) {
+							if ((void(*)()) 1 == callbackNvtAO) {
+								// Only the client that asked for it
+								dropClient(from);
+								return false;
+							} else {
+								callbackNvtAO();
+							}
+						}
+						break;
+					case 246:   // Telnet command "Are you there"
+						if (callbackNvtAYT != NULL) {
+							callbackNvtAYT();
+						}
+						break;
+					case 247:   // Telnet command "Erase character"
+						if (callbackNvtEC != NULL) {
+							callbackNvtEC();
+						}
+						break;
+					case 248:   // Telnet command "Erase line"
+						if (callbackNvtEL != NULL) {
+							callbackNvtEL();
+						}
+						break;
+					case 249:   // Telnet command "Go ahead"
+						if (callbackNvtGA != NULL) {
+							callbackNvtGA();
+						}
+						break;
+					case 250:   // Telnet command "SB" (additional data follows up to IAC SE)
+						from.nvtState = NVT_SB;
+						break;
+					case 251:   // Telnet command "WILL"
+					case 252:   // Telnet command "WON'T"
+					case 253:   // Telnet command "DO"
+					case 254:   // Telnet command "DON'T"
+						from.nvtDetected = true;
+						from.nvtCommand = c;
+						from.nvtState = NVT_OPTION;
+						break;
+					case 255:   // Escaped data byte 0xff
+						if (recBuf) {
+							writeRecBuf((const char*) &c, 1);
+						} else {
+							// If no receive buffer is used, the data byte 0xff will be lost.
+							// May be in the future there is a solution for this problem.
+						}
+						break;
+				}
+				break;
+			case NVT_OPTION:    // Option byte of WILL / WON'T / DO / DON'T
+				run = i + 1;
+				from.nvtState = NVT_DATA;
+				if (callbackNvtWWDD != NULL) {
+					callbackNvtWWDD(from.nvtCommand, c);
+				}
+				break;
+			case NVT_SB:        // Additional data is ignored
+				run = i + 1;
+				if (c == 255) {
+					from.nvtState = NVT_SB_IAC;
+				}
+				break;
+			case NVT_SB_IAC:
+				run = i + 1;
+				from.nvtState = (c == 240) ? NVT_DATA : NVT_SB;    // SE ends the additional data
+				break;
+		}
+	}
+	if (recBuf && (len > run)) {
+		writeRecBuf((const char*) &data[run], len - run);
+	}
+	if (!from.echoPending && (recHead.load(std::memory_order_relaxed) != recStart)) {
+		// Interactive input: flush the next output without collecting
+		from.echoPending = true;
+		from.echoRef = millis();
+	}
+	return true;
+}
+
@@ -48,21 +48,27 @@
  * Default: "Connection established via TelnetSpy.\n"
  *		void setWelcomeMsg(char* msg);
  *
- * Change the message which will be send to the telnet client if another
- * session is already established.
- * Default: "TelnetSpy: Only one connection possible.\n"
+ * Change the message which will be send to the telnet client if all
+ * TELNETSPY_MAX_CLIENTS sessions are already established.
+ * Default: "TelnetSpy: All connections in use.\n"
  *		void setRejectMsg(char* msg);
  *
  * Change the amount of characters to collect before sending a telnet block.
+ * This is where every client starts: while a block fills up before the
+ * collecting time runs out, the amount is doubled for the next block (up to
+ * maxSize), when the collecting time runs out first it is halved again (down
+ * to minSize). Output that follows input received from a client (its echo)
+ * is sent to that client without collecting.
  * Default: 64 
  *		void setMinBlockSize(uint16_t minSize);
  *
  * Change the time (in ms) to wait before sending a telnet block if its size is
- * less than <minSize> (defined by setMinBlockSize).
+ * less than the current amount to collect (see setMinBlockSize).
  * Default: 100
  *		void setCollectingTime(uint16_t colTime);
  *
- * Change the maximum size of the telnet packets to send.
+ * Change the maximum size of the telnet packets to send. On ESP8266 a block is
+ * also limited to the free TCP send window of the client.
  * Default: 512
  *		void setMaxBlockSize(uint16_t maxSize);
  *
@@ -72,7 +78,7 @@
  * Changing size tries to preserve the already collected data. If the new
  * buffer size is too small the youngest data will be preserved only. Returns
  * false if the requested buffer size cannot be set.
- * Default: 3000
+ * Default: 4096
  *		bool setBufferSize(uint16_t newSize);
  *
  * This function returns the actual size of the transmit buffer.
@@ -99,8 +105,10 @@
  * TelnetSpy (there is still a buffer in the underlayed WifiClient component).
  * Returns false if the requested buffer size cannot be set.
  * - If the receive buffer is used and it is full, additional received data
- * will be lost. But all telnet NVT protocol data and the "filter character" is
- * still handled (see "setFilter" and the NVT callbacks below).
+ * stays in the WiFiClient (and the TCP window) until read() made room, so
+ * pasted input is not lost. NVT protocol data and the "filter character" are
+ * handled as soon as they are taken (see "setFilter" and the NVT callbacks
+ * below).
  * - If no receive buffer is used and the received characters are not retrieved
  * by your app, the handling of the NVT protocol and the "filter character"
  * will not work. If no receive buffer is used, you cannot receive the code
@@ -116,9 +124,29 @@
  * Default: Serial
  *		void setSerial(HardwareSerial* usedSerial);
  *
- * This function returns true, if a telnet client is connected.
+ * This function returns true, if at least one telnet client is connected.
  *		bool isClientConnected();
  *
+ * This function returns the number of connected telnet clients.
+ *		uint8_t getClientCount();
+ *
+ * This function returns how many bytes the client in slot <idx> (0 ..
+ * TELNETSPY_MAX_CLIENTS - 1) has missed since it connected because it fell
+ * behind the transmit buffer.
+ *		uint32_t getClientLag(uint8_t idx);
+ *
+ * These functions return how many unsent bytes / lines were dropped from the
+ * transmit buffer on overflow since startup.
+ *		uint32_t getDroppedBytes();
+ *		uint32_t getDroppedLines();
+ *
+ * These functions help tuning the batching: the average number of telnet
+ * packets sent per KB of data, and the average / maximum time (in ms) from
+ * received input to its echo being sent.
+ *		uint16_t getPacketsPerKB();
+ *		uint16_t getEchoLatency();
+ *		uint16_t getEchoLatencyMax();
+ *
  * This function installs a callback function which will be called on every
  * telnet connect of this object (except rejected connect tries). Use NULL to
  * remove the callback.
@@ -131,7 +159,14 @@
  * Default: NULL
  *		void setCallbackOnDisconnect(void (*callback)());
  *
- * This function disconnects an active client connection.
+ * This function installs a callback function which will be called with every
+ * span passed to write(), before it is buffered or sent (e.g. to keep a copy
+ * of the log somewhere else). Single chars written through debugWrite() are
+ * not reported. Use NULL to remove the callback.
+ * Default: NULL
+ *		void setCallbackOnWrite(void (*callback)(const uint8_t* data, size_t len));
+ *
+ * This function disconnects all active client connections.
  *      void disconnectClient();
  *
  * This function clears the transmit buffer of TelnetSpy, so all waiting data
@@ -222,11 +257,23 @@
  * Transfering data also via telnet will need more performance than the serial
  * port only. So time critical things may be influenced.
  *
- * It is not possible to establish more than one telnet connection at the same
- * time. But its possible to use more than one instance of TelnetSpy.
+ * Up to TELNETSPY_MAX_CLIENTS telnet connections can be established at the
+ * same time. All of them share the one transmit buffer, each with its own read
+ * position. A client that falls so far behind that its data is dropped from
+ * the buffer skips the dropped part and gets a gap marker (TELNETSPY_GAP_MSG)
+ * instead, so a slow reader never holds back the others. Data received from
+ * any client is handled as received by serial port. Its also possible to use
+ * more than one instance of TelnetSpy.
  *
  * If you have problems with low memory you may reduce the value of the define
  * TELNETSPY_BUFFER_LEN for a smaller ring buffer on initialisation.    
+ * The ring buffer sizes (TELNETSPY_BUFFER_LEN, TELNETSPY_REC_BUFFER_LEN and
+ * setBufferSize() / setRecBufferSize()) are rounded down to a power of two,
+ * 32768 at most.
+ *
+ * The transmit ring is single consumer (handle()) / multi producer (print,
+ * os_printf and interrupt context). Only the producers take a critical
+ * section, the consumer works lock free on atomic head / tail indices.
  *
  * Usage of void setDebugOutput(bool) to enable / disable of capturing of
  * os_print calls when you have more than one TelnetSpy instance: That
@@ -239,7 +286,7 @@
 #ifndef TelnetSpy_h
 #define TelnetSpy_h
 
-#define TELNETSPY_BUFFER_LEN 3000
+#define TELNETSPY_BUFFER_LEN 4096
 #define TELNETSPY_MIN_BLOCK_SIZE 64
 #define TELNETSPY_COLLECTING_TIME 100
 #define TELNETSPY_MAX_BLOCK_SIZE 512
@@ -247,8 +294,15 @@
 #define TELNETSPY_PORT 23
 #define TELNETSPY_CAPTURE_OS_PRINT true
 #define TELNETSPY_WELCOME_MSG "Connection established via TelnetSpy.\r\n"
-#define TELNETSPY_REJECT_MSG "TelnetSpy: Only one connection possible.\r\n"
+#define TELNETSPY_REJECT_MSG "TelnetSpy: All connections in use.\r\n"
 #define TELNETSPY_REC_BUFFER_LEN 64
+#define TELNETSPY_REC_BLOCK_LEN 128  // bytes taken from the socket per read
+#define TELNETSPY_GAP_MSG "\r\n[%u bytes dropped]\r\n"
+#define TELNETSPY_GAP_LEN 40
+#define TELNETSPY_LINE_INDEX 64     // power of two, 128 at most
+#ifndef TELNETSPY_MAX_CLIENTS
+#define TELNETSPY_MAX_CLIENTS 2
+#endif
 
 #ifdef ESP8266
 #include <ESP8266WiFi.h>
@@ -269,6 +323,7 @@
 #define CRITCAL_SECTION_END portEXIT_CRITICAL(&AtomicMutex);
 #endif
 #include <WiFiClient.h>
+#include <atomic>
 
 class TelnetSpy : public Stream {
 	public:
@@ -292,8 +347,16 @@ class TelnetSpy : public Stream {
 		uint16_t getRecBufferSize();
 		void setSerial(HardwareSerial* usedSerial);
 		bool isClientConnected();
+		uint8_t getClientCount();
+		uint32_t getClientLag(uint8_t idx);
+		uint32_t getDroppedBytes();
+		uint32_t getDroppedLines();
+		uint16_t getPacketsPerKB();
+		uint16_t getEchoLatency();
+		uint16_t getEchoLatencyMax();
 		void setCallbackOnConnect(void (*callback)());
 		void setCallbackOnDisconnect(void (*callback)());
+		void setCallbackOnWrite(void (*callback)(const uint8_t* data, size_t len));
         void disconnectClient();
         void clearBuffer();
         void setFilter(char ch, const char* msg, void (*callback)());
@@ -332,6 +395,7 @@ class TelnetSpy : public Stream {
 		void flush(void) override;
 		void debugWrite(uint8_t);
 		size_t write(uint8_t) override;
+		size_t write(const uint8_t* data, size_t len) override;
 		inline size_t write(unsigned long n) { return write((uint8_t) n); }
 		inline size_t write(long n) { return write((uint8_t) n); }
 		inline size_t write(unsigned int n) { return write((uint8_t) n); }
@@ -342,26 +406,58 @@ class TelnetSpy : public Stream {
 		uint32_t baudRate(void);
 
 	protected:
+		typedef struct {
+			WiFiClient client;
+			uint32_t cursor;                // next transmit buffer position to send
+			uint32_t lag;                   // bytes skipped because the client fell behind
+			unsigned long waitRef;
+			unsigned long pingRef;
+			bool nvtDetected;
+			uint8_t nvtState;               // receive parser state, survives split telegrams
+			uint8_t nvtCommand;             // WILL / WON'T / DO / DON'T waiting for its option
+			uint16_t batch;                 // bytes to collect before sending, adapts to the output rate
+			unsigned long echoRef;          // when input waiting for its echo was received
+			bool echoPending;
+			bool connected;
+		} TelnetSpyClient;
+		enum {
+			NVT_DATA,
+			NVT_IAC,
+			NVT_OPTION,
+			NVT_SB,
+			NVT_SB_IAC
+		};
 		CRITCAL_SECTION_MUTEX
 		void sendBlock(void);
+		void sendBlock(TelnetSpyClient& c);
+		bool claimSender();
+		void releaseSender();
+		void sendClientBlock(TelnetSpyClient& c);
+		uint16_t skipClient(TelnetSpyClient& c, uint32_t skipped);
+		void dropClient(TelnetSpyClient& c);
+		void updateConnected();
+		void clampBatches();
 		void addTelnetBuf(char c);
-		char pullTelnetBuf();
-		char peekTelnetBuf();
+		void addTelnetBuf(const char* data, uint16_t len);
+		void freeTelnetBuf(uint16_t needed);
+		void indexLines(const char* data, uint16_t len, uint32_t pos);
+		uint32_t telnetStart();
+		uint16_t telnetUsed();
+		static uint16_t floorPow2(uint16_t n);
 		int telnetAvailable();
-        void writeRecBuf(char c);
+        void writeRecBuf(const char* data, uint16_t len);
         void checkReceive();
+        void checkReceive(TelnetSpyClient& from);
+        bool parseReceived(TelnetSpyClient& from, const uint8_t* data, int len);
 		WiFiServer* telnetServer;
-		WiFiClient client;
+		TelnetSpyClient clients[TELNETSPY_MAX_CLIENTS];
 		uint16_t port;
 		HardwareSerial* usedSer;
 		bool storeOffline;
 		bool started;
 		bool listening;
 		bool firstMainLoop;
-		unsigned long waitRef;
-		unsigned long pingRef;
 		uint16_t pingTime;
-        bool nvtDetected;
 		char* welcomeMsg;
 		char* rejectMsg;
         char filterChar;
@@ -372,18 +468,30 @@ class TelnetSpy : public Stream {
 		uint16_t maxBlockSize;
 		bool debugOutput;
 		char* telnetBuf;
-		uint16_t bufLen;
-		uint16_t bufUsed;
-		uint16_t bufRdIdx;
-		uint16_t bufWrIdx;
+		uint16_t bufLen;                    // power of two
+		std::atomic<uint32_t> bufHead;      // free running, written by producers
+		std::atomic<uint32_t> bufTail;      // slowest client's cursor, written by the consumer
+		std::atomic<uint32_t> bufEvict;     // drop point published by producers on overflow
+		std::atomic_flag sending = ATOMIC_FLAG_INIT;    // claimed by whoever runs sendBlock()
+		uint32_t lineStart[TELNETSPY_LINE_INDEX];   // starts of the youngest lines, producer owned
+		uint8_t lineRd;
+		uint8_t lineWr;
+		uint32_t droppedBytes;
+		uint32_t droppedLines;
+		uint32_t txPackets;
+		uint32_t txBytes;
+		uint16_t echoLatency;               // running average in ms
+		uint16_t echoLatencyMax;
+		char* blockBuf;                     // consumer's copy of the block being sent
+		uint16_t blockLen;
 		char* recBuf;
-		uint16_t recLen;
-		uint16_t recUsed;
-		uint16_t recRdIdx;
-		uint16_t recWrIdx;
-		bool connected;
+		uint16_t recLen;                    // power of two
+		std::atomic<uint16_t> recHead;
+		std::atomic<uint16_t> recTail;
+		bool connected;                     // at least one client connected
 		void (*callbackConnect)();
 		void (*callbackDisconnect)();
+		void (*callbackWrite)(const uint8_t* data, size_t len);
         void (*callbackNvtBRK)();
         void (*callbackNvtIP)();
         void (*callbackNvtAO)();
@@ -0,0 +1,236 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// http admission control
+//
+// the first handler every request meets. it caps the number of requests in
+// flight across all clients and runs a token bucket per client ip. requests
+// over either limit get a bodiless 503 / 429 before any other handler, file
+// lookup or template work is done, so bursts from browsers and OS probe
+// daemons cannot starve loop() or exhaust the heap.
+//
+// a request in flight holds one of ADMISSION_MAX_IN_FLIGHT slots. the slot is
+// given back from request->onDisconnect, which is the request's only
+// disconnect hook: a later onDisconnect() on the same request replaces ours.
+// nothing in src/ sets one (grep onDisconnect), but a library handler could,
+// so a slot is also a lease -- one held longer than ADMISSION_LEASE_MS is
+// reclaimed on the next admission or by housekeeping, whichever comes
+// first. a lost callback costs one slot for a
+// while instead of the server forever.
+
+#define ADMISSION_MAX_IN_FLIGHT     6
+#define ADMISSION_CLIENTS           8
+#define ADMISSION_RATE_PER_S        10      // sustained requests per second per ip
+#define ADMISSION_BURST             20      // bucket size per ip
+#define ADMISSION_PENDING           4
+#define ADMISSION_LEASE_MS          90000UL // longer than any long-poll
+
+typedef struct admission_client {
+    uint32_t ip;
+    uint32_t tokens;            // in 1/1000 of a request
+    unsigned long refill_ms;
+} ADMISSION_CLIENT;
+
+typedef struct admission_slot {
+    AsyncWebServerRequest* request;
+    unsigned long since_ms;
+} ADMISSION_SLOT;
+
+typedef struct admission_stats {
+    uint32_t served;
+    uint32_t rejected_busy;
+    uint32_t rejected_rate;
+    uint32_t reclaimed;         // leases that never saw their disconnect
+    uint16_t in_flight;
+    uint16_t peak_in_flight;
+} ADMISSION_STATS;
+
+ADMISSION_CLIENT admission_clients[ADMISSION_CLIENTS];
+ADMISSION_SLOT admission_slots[ADMISSION_MAX_IN_FLIGHT];
+volatile ADMISSION_STATS admission_stats;
+WEB_LOCK_DECLARE(admission_lock);   // the slots, housekeeping reclaims from loop()
+
+// gives back slots held longer than their lease, caller holds admission_lock
+void admissionExpire() {
+    const unsigned long now = millis();
+
+    for (tiny_int i = 0; i < ADMISSION_MAX_IN_FLIGHT; i++) {
+        ADMISSION_SLOT* slot = &admission_slots[i];
+        if (slot->request != NULL && now - slot->since_ms >= ADMISSION_LEASE_MS) {
+            slot->request = NULL;
+            admission_stats.in_flight--;
+            admission_stats.reclaimed++;
+        }
+    }
+}
+
+void admissionReclaim() {
+    WEB_LOCK(admission_lock);
+    admissionExpire();
+    WEB_UNLOCK(admission_lock);
+}
+
+// reclaims expired leases, returns a free slot or NULL when all are taken.
+// caller holds admission_lock
+ADMISSION_SLOT* admissionSlot() {
+    admissionExpire();
+
+    for (tiny_int i = 0; i < ADMISSION_MAX_IN_FLIGHT; i++) {
+        if (admission_slots[i].request == NULL) return &admission_slots[i];
+    }
+    return NULL;
+}
+
+// no-op when the lease was already reclaimed
+void admissionRelease(AsyncWebServerRequest* request) {
+    WEB_LOCK(admission_lock);
+    for (tiny_int i = 0; i < ADMISSION_MAX_IN_FLIGHT; i++) {
+        if (admission_slots[i].request == request) {
+            admission_slots[i].request = NULL;
+            admission_stats.in_flight--;
+            break;
+        }
+    }
+    WEB_UNLOCK(admission_lock);
+}
+
+// returns false when the client's bucket is empty
+bool admissionTakeToken(uint32_t ip) {
+    const unsigned long now = millis();
+    ADMISSION_CLIENT* slot = &admission_clients[0];
+
+    // find the client or recycle the least recently refilled slot
+    for (tiny_int i = 0; i < ADMISSION_CLIENTS; i++) {
+        if (admission_clients[i].ip == ip) {
+            slot = &admission_clients[i];
+            break;
+        }
+        if (now - admission_clients[i].refill_ms > now - slot->refill_ms) slot = &admission_clients[i];
+    }
+
+    if (slot->ip != ip) {
+        slot->ip = ip;
+        slot->tokens = ADMISSION_BURST * 1000UL;
+    } else {
+        const unsigned long elapsed = now - slot->refill_ms;
+        if (elapsed >= ADMISSION_BURST * 1000UL / ADMISSION_RATE_PER_S) {
+            slot->tokens = ADMISSION_BURST * 1000UL;
+        } else {
+            slot->tokens = min((uint32_t) (slot->tokens + elapsed * ADMISSION_RATE_PER_S), (uint32_t) (ADMISSION_BURST * 1000UL));
+        }
+    }
+    slot->refill_ms = now;
+
+    if (slot->tokens < 1000) return false;
+    slot->tokens -= 1000;
+    return true;
+}
+
+class AdmissionHandler : public AsyncWebHandler {
+    public:
+        bool canHandle(AsyncWebServerRequest* request) override {
+            // websocket upgrades hand the connection over to the socket and never
+            // report a disconnect through the request
+            if (request->hasHeader("Upgrade")) return false;
+
+            short code = 0;
+            const uint32_t ip = (uint32_t) request->client()->remoteIP();
+            WEB_LOCK(admission_lock);
+            ADMISSION_SLOT* slot = admissionSlot();
+            if (slot == NULL) {
+                code = 503;
+                admission_stats.rejected_busy++;
+            } else if (!admissionTakeToken(ip)) {
+                code = 429;
+                admission_stats.rejected_rate++;
+            } else {
+                slot->request = request;
+                slot->since_ms = millis();
+                admission_stats.served++;
+                admission_stats.in_flight++;
+                if (admission_stats.in_flight > admission_stats.peak_in_flight) admission_stats.peak_in_flight = admission_stats.in_flight;
+            }
+            WEB_UNLOCK(admission_lock);
+
+            if (code != 0) {
+                for (tiny_int i = 0; i < ADMISSION_PENDING; i++) {
+                    if (pending[i].request == NULL) {
+                        pending[i].request = request;
+                        pending[i].code = code;
+                        break;
+                    }
+                }
+                // a client that goes away before handleRequest() must not leave
+                // its pointer behind for the next request at the same address
+                request->onDisconnect([this, request]() { forget(request); });
+                return true;
+            }
+
+            request->onDisconnect([request]() { admissionRelease(request); });
+
+            return false;
+        }
+
+        void handleRequest(AsyncWebServerRequest* request) override {
+            const short code = forget(request);
+
+            AsyncWebServerResponse* response = request->beginResponse(code);
+            response->addHeader("Retry-After", "1");
+            request->send(response);
+        }
+
+    private:
+        // clears the request's entry, returns its code (503 if it had none)
+        short forget(AsyncWebServerRequest* request) {
+            for (tiny_int i = 0; i < ADMISSION_PENDING; i++) {
+                if (pending[i].request == request) {
+                    pending[i].request = NULL;
+                    return pending[i].code;
+                }
+            }
+            return 503;
+        }
+
+        // only touched from the web server's context
+        struct {
+            AsyncWebServerRequest* request;
+            short code;
+        } pending[ADMISSION_PENDING] = {};
+};
+
+AdmissionHandler admission_handler;
+
+void admissionStatsJson(char* buf, size_t len) {
+    snprintf(buf, len, "{\"served\":%u,\"rejected_busy\":%u,\"rejected_rate\":%u,\"reclaimed\":%u,\"in_flight\":%u,\"peak_in_flight\":%u}",
+        (unsigned int) admission_stats.served, (unsigned int) admission_stats.rejected_busy, (unsigned int) admission_stats.rejected_rate,
+        (unsigned int) admission_stats.reclaimed, (unsigned int) admission_stats.in_flight, (unsigned int) admission_stats.peak_in_flight);
+}
+
+void cmdAdmissionStats(int argc, char** argv) {
+    char stats[192];
+    admissionStatsJson(stats, sizeof(stats));
+    CONSOLE_PRINTF("\nHTTP admission: %s\n", stats);
+}
+
+void wireAdmission() {
+    memset(admission_clients, 0, sizeof(admission_clients));
+    memset(admission_slots, 0, sizeof(admission_slots));
+    memset((void*) &admission_stats, 0, sizeof(admission_stats));
+
+    // must be registered before any other handler
+    server.addHandler(&admission_handler);
+
+    server.on("/api/http/stats", HTTP_GET, [](AsyncWebServerRequest* request)
+        {
+            char stats[192];
+            admissionStatsJson(stats, sizeof(stats));
+            request->send(200, "application/json", stats);
+        });
+
+    shellRegister("http", "HTTP Admission Stats", cmdAdmissionStats);
+}
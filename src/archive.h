@@ -0,0 +1,464 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// bulk export / import of the device state
+//
+// GET  /api/export  streams one archive
+// POST /api/import  takes the same archive as an application/octet-stream body
+//
+// archive layout (little endian):
+//
+//   header    "LIRA" | version u8 | section count u8 | reserved u16
+//   manifest  one entry per section: type u8 | reserved u8[3] | length u32 | name char[8]
+//   sections  section data followed by the CRC32 of that data
+//
+// both directions stream straight between the socket and LittleFS in the
+// chunks the web server hands us, so RAM use does not depend on file size.
+// imported file sections are written to a temp file and only replace the
+// original once their CRC checks out and every byte reached flash. an
+// imported config is sanitized like one read from EEPROM. sections with an unknown type are
+// skipped, so older firmware can read newer archives.
+
+#define ARCHIVE_MAGIC               "LIRA"
+#define ARCHIVE_VERSION             1
+#define ARCHIVE_MAX_SECTIONS        8
+#define ARCHIVE_HEADER_LEN          8
+#define ARCHIVE_MANIFEST_LEN        16
+#define ARCHIVE_STALE_MS            10000
+#define ARCHIVE_IMPORT_TMP          "/import.tmp"
+
+#define ARCHIVE_CONFIG              1
+#define ARCHIVE_CODES               2
+#define ARCHIVE_HISTORY             4
+
+typedef struct archive_section {
+    tiny_int type;
+    const char* name;
+    const char* path;       // NULL => the config struct
+} ARCHIVE_SECTION;
+
+const ARCHIVE_SECTION archive_sections[] = {
+    { ARCHIVE_CONFIG,  "config",  NULL },
+    { ARCHIVE_CODES,   "codes",   "/last_signal.txt" },
+    { ARCHIVE_HISTORY, "history", "/signals.txt" },
+};
+
+#define ARCHIVE_SECTION_COUNT (sizeof(archive_sections) / sizeof(archive_sections[0]))
+
+typedef enum {
+    ARCHIVE_HEAD,
+    ARCHIVE_DATA,
+    ARCHIVE_CRC,
+    ARCHIVE_DONE
+} ARCHIVE_PHASE;
+
+typedef struct archive_manifest_entry {
+    tiny_int type;
+    uint32_t length;
+} ARCHIVE_MANIFEST_ENTRY;
+
+typedef struct archive_stream {
+    bool busy;
+    unsigned long touched_ms;
+    ARCHIVE_PHASE phase;
+    tiny_int section;
+    tiny_int section_count;
+    ARCHIVE_MANIFEST_ENTRY manifest[ARCHIVE_MAX_SECTIONS];
+    uint32_t remaining;
+    uint32_t crc;
+    File file;
+    uint32_t written;           // bytes of the section that reached the temp file
+    uint8_t head[ARCHIVE_HEADER_LEN + ARCHIVE_MANIFEST_LEN * ARCHIVE_MAX_SECTIONS];
+    uint16_t head_len;
+    uint16_t head_pos;
+    tiny_int applied;
+    tiny_int failed;
+    const char* error;
+    AsyncWebServerRequest* owner;
+} ARCHIVE_STREAM;
+
+ARCHIVE_STREAM archive_export;
+ARCHIVE_STREAM archive_import;
+CONFIG_TYPE archive_config;
+
+// standard (zlib) CRC32 using a 16 entry nibble table
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *data) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (*data >> 4)) & 0x0F] ^ (crc >> 4);
+        data++;
+    }
+    return ~crc;
+}
+
+void archivePut32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+uint32_t archiveGet32(const uint8_t* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+bool archiveClaim(ARCHIVE_STREAM* stream, AsyncWebServerRequest* request) {
+    // a stream nobody has touched for a while belongs to a client that went away
+    if (stream->busy && millis() - stream->touched_ms < ARCHIVE_STALE_MS) return false;
+
+    if (stream->file) stream->file.close();
+    memset((void*) stream->manifest, 0, sizeof(stream->manifest));
+    stream->busy = true;
+    stream->touched_ms = millis();
+    stream->owner = request;
+    stream->phase = ARCHIVE_HEAD;
+    stream->section = 0;
+    stream->head_pos = 0;
+    stream->applied = 0;
+    stream->failed = 0;
+    stream->error = NULL;
+    return true;
+}
+
+void archiveRelease(ARCHIVE_STREAM* stream) {
+    if (stream->file) stream->file.close();
+    stream->busy = false;
+    stream->owner = NULL;
+}
+
+// ---------------------------------------------------------------- export
+
+void archiveExportSection() {
+    ARCHIVE_STREAM* ex = &archive_export;
+
+    if (ex->section >= ex->section_count) {
+        archiveRelease(ex);
+        ex->phase = ARCHIVE_DONE;
+        return;
+    }
+
+    const ARCHIVE_SECTION* section = &archive_sections[ex->section];
+    if (section->path != NULL) ex->file = LittleFS.open(section->path, FILE_READ);
+
+    ex->remaining = ex->manifest[ex->section].length;
+    ex->crc = 0;
+    ex->phase = ARCHIVE_DATA;
+}
+
+size_t archiveExportFill(uint8_t* buffer, size_t maxLen, size_t index) {
+    ARCHIVE_STREAM* ex = &archive_export;
+    size_t used = 0;
+
+    ex->touched_ms = millis();
+
+    while (used < maxLen && ex->phase != ARCHIVE_DONE) {
+        size_t n;
+
+        switch (ex->phase) {
+        case ARCHIVE_HEAD:
+            n = min((size_t) (ex->head_len - ex->head_pos), maxLen - used);
+            memcpy(buffer + used, ex->head + ex->head_pos, n);
+            ex->head_pos += n;
+            used += n;
+            if (ex->head_pos == ex->head_len) archiveExportSection();
+            break;
+        case ARCHIVE_DATA:
+            n = min((size_t) ex->remaining, maxLen - used);
+            if (archive_sections[ex->section].path == NULL) {
+                memcpy(buffer + used, ((uint8_t*) &config) + (ex->manifest[ex->section].length - ex->remaining), n);
+            } else {
+                // lengths are fixed by the manifest, pad if the file shrank meanwhile
+                size_t got = ex->file ? ex->file.read(buffer + used, n) : 0;
+                if (got < n) memset(buffer + used + got, 0, n - got);
+            }
+            ex->crc = crc32Update(ex->crc, buffer + used, n);
+            ex->remaining -= n;
+            used += n;
+            if (ex->remaining == 0) {
+                if (ex->file) ex->file.close();
+                archivePut32(ex->head, ex->crc);
+                ex->head_len = 4;
+                ex->head_pos = 0;
+                ex->phase = ARCHIVE_CRC;
+            }
+            break;
+        case ARCHIVE_CRC:
+            n = min((size_t) (ex->head_len - ex->head_pos), maxLen - used);
+            memcpy(buffer + used, ex->head + ex->head_pos, n);
+            ex->head_pos += n;
+            used += n;
+            if (ex->head_pos == ex->head_len) {
+                ex->section++;
+                archiveExportSection();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return used;
+}
+
+void archiveExportRequest(AsyncWebServerRequest* request) {
+    ARCHIVE_STREAM* ex = &archive_export;
+
+    if (!archiveClaim(ex, request)) {
+        request->send(503, "text/plain", "export already running");
+        return;
+    }
+
+    ex->section_count = ARCHIVE_SECTION_COUNT;
+
+    uint8_t* p = ex->head;
+    memcpy(p, ARCHIVE_MAGIC, 4);
+    p[4] = ARCHIVE_VERSION;
+    p[5] = ex->section_count;
+    p[6] = 0;
+    p[7] = 0;
+    p += ARCHIVE_HEADER_LEN;
+
+    size_t total = ARCHIVE_HEADER_LEN;
+    for (tiny_int i = 0; i < ex->section_count; i++) {
+        const ARCHIVE_SECTION* section = &archive_sections[i];
+        uint32_t length = sizeof(CONFIG_TYPE);
+
+        if (section->path != NULL) {
+            length = 0;
+            if (LittleFS.exists(section->path)) {
+                File file = LittleFS.open(section->path, FILE_READ);
+                length = file.size();
+                file.close();
+            }
+        }
+
+        ex->manifest[i].type = section->type;
+        ex->manifest[i].length = length;
+
+        memset(p, 0, ARCHIVE_MANIFEST_LEN);
+        p[0] = section->type;
+        archivePut32(p + 4, length);
+        strncpy((char*) p + 8, section->name, 8);
+        p += ARCHIVE_MANIFEST_LEN;
+
+        total += ARCHIVE_MANIFEST_LEN + length + 4;
+    }
+    ex->head_len = p - ex->head;
+
+    AsyncWebServerResponse* response = request->beginResponse("application/octet-stream", total, archiveExportFill);
+    char disposition[HOSTNAME_LEN + 32];
+    snprintf(disposition, sizeof(disposition), "attachment; filename=\"%s.lira\"", config.hostname);
+    response->addHeader("Content-Disposition", disposition);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+    LOG_INFO(FS, "\n%s streaming %u bytes\n", request->url().c_str(), (unsigned int) total);
+}
+
+// ---------------------------------------------------------------- import
+
+const ARCHIVE_SECTION* archiveFindSection(tiny_int type) {
+    for (size_t i = 0; i < ARCHIVE_SECTION_COUNT; i++) {
+        if (archive_sections[i].type == type) return &archive_sections[i];
+    }
+    return NULL;
+}
+
+void archiveImportSection() {
+    ARCHIVE_STREAM* im = &archive_import;
+
+    if (im->section >= im->section_count) {
+        im->phase = ARCHIVE_DONE;
+        return;
+    }
+
+    const ARCHIVE_SECTION* section = archiveFindSection(im->manifest[im->section].type);
+    if (section != NULL && section->path != NULL) {
+        im->file = LittleFS.open(ARCHIVE_IMPORT_TMP, FILE_WRITE);
+        // a stale temp file must not be taken for this section
+        if (!im->file) LittleFS.remove(ARCHIVE_IMPORT_TMP);
+    }
+    im->written = 0;
+
+    im->remaining = im->manifest[im->section].length;
+    im->crc = 0;
+    im->head_pos = 0;
+    im->phase = im->remaining > 0 ? ARCHIVE_DATA : ARCHIVE_CRC;
+}
+
+// archives from before the wifi cache carry the shorter config
+bool archiveConfigLength(uint32_t length) {
+    return length == sizeof(CONFIG_TYPE) || length == CONFIG_BASE_LEN;
+}
+
+void archiveImportApply() {
+    ARCHIVE_STREAM* im = &archive_import;
+    const ARCHIVE_MANIFEST_ENTRY* entry = &im->manifest[im->section];
+    const ARCHIVE_SECTION* section = archiveFindSection(entry->type);
+
+    if (im->file) im->file.close();
+
+    if (archiveGet32(im->head) != im->crc) {
+        im->failed++;
+        LOG_WARN(FS, "import: section %d crc mismatch -- skipped\n", entry->type);
+        LittleFS.remove(ARCHIVE_IMPORT_TMP);
+    } else if (section == NULL || (section->path == NULL && !archiveConfigLength(entry->length))) {
+        LOG_WARN(FS, "import: section %d not supported -- skipped\n", entry->type);
+    } else if (section->path == NULL) {
+        memcpy(&config, &archive_config, entry->length);
+        configSanitize(&config);
+        // the wifi cache belongs to the device the archive came from
+        config.wifi_cache_flag = CFG_NOT_SET;
+        configStoreSave();
+        setup_needs_update = true;
+        im->applied++;
+        LOG_INFO(FS, "import: %s applied\n", section->name);
+    } else if (im->written != entry->length || !LittleFS.rename(ARCHIVE_IMPORT_TMP, section->path)) {
+        // the crc covers what was received, not what reached flash
+        im->failed++;
+        LOG_WARN(FS, "import: %s not written (%u of %u bytes) -- old file kept\n", section->name,
+            (unsigned int) im->written, (unsigned int) entry->length);
+        LittleFS.remove(ARCHIVE_IMPORT_TMP);
+    } else {
+        // rename replaces the old file, it is never missing
+        im->applied++;
+        LOG_INFO(FS, "import: %s applied (%u bytes)\n", section->name, (unsigned int) entry->length);
+    }
+
+    im->section++;
+    archiveImportSection();
+}
+
+void archiveImportFeed(const uint8_t* data, size_t len) {
+    ARCHIVE_STREAM* im = &archive_import;
+
+    while (len > 0 && im->phase != ARCHIVE_DONE && im->error == NULL) {
+        size_t n;
+
+        switch (im->phase) {
+        case ARCHIVE_HEAD:
+            // header and manifest are small enough to collect whole
+            n = min((size_t) (im->head_len - im->head_pos), len);
+            memcpy(im->head + im->head_pos, data, n);
+            im->head_pos += n;
+            data += n;
+            len -= n;
+
+            if (im->head_pos == ARCHIVE_HEADER_LEN && im->head_len == ARCHIVE_HEADER_LEN) {
+                if (memcmp(im->head, ARCHIVE_MAGIC, 4) != 0 || im->head[4] != ARCHIVE_VERSION) {
+                    im->error = "not a version 1 archive";
+                } else if (im->head[5] > ARCHIVE_MAX_SECTIONS) {
+                    im->error = "too many sections";
+                } else if (im->head[5] == 0) {
+                    im->phase = ARCHIVE_DONE;
+                } else {
+                    im->section_count = im->head[5];
+                    im->head_len += im->section_count * ARCHIVE_MANIFEST_LEN;
+                }
+            }
+
+            if (im->error == NULL && im->head_pos == im->head_len && im->head_len > ARCHIVE_HEADER_LEN) {
+                for (tiny_int i = 0; i < im->section_count; i++) {
+                    const uint8_t* p = im->head + ARCHIVE_HEADER_LEN + i * ARCHIVE_MANIFEST_LEN;
+                    im->manifest[i].type = p[0];
+                    im->manifest[i].length = archiveGet32(p + 4);
+                }
+                im->section = 0;
+                archiveImportSection();
+            }
+            break;
+        case ARCHIVE_DATA:
+        {
+            const ARCHIVE_MANIFEST_ENTRY* entry = &im->manifest[im->section];
+            n = min((size_t) im->remaining, len);
+
+            if (im->file) {
+                im->written += im->file.write(data, n);
+            } else if (entry->type == ARCHIVE_CONFIG && archiveConfigLength(entry->length)) {
+                memcpy(((uint8_t*) &archive_config) + (entry->length - im->remaining), data, n);
+            }
+
+            im->crc = crc32Update(im->crc, data, n);
+            im->remaining -= n;
+            data += n;
+            len -= n;
+            if (im->remaining == 0) {
+                im->head_pos = 0;
+                im->phase = ARCHIVE_CRC;
+            }
+        }
+        break;
+        case ARCHIVE_CRC:
+            n = min((size_t) (4 - im->head_pos), len);
+            memcpy(im->head + im->head_pos, data, n);
+            im->head_pos += n;
+            data += n;
+            len -= n;
+            if (im->head_pos == 4) archiveImportApply();
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void archiveImportBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+    ARCHIVE_STREAM* im = &archive_import;
+
+    if (index == 0) {
+        if (im->owner == request) archiveRelease(im);
+        if (!archiveClaim(im, request)) return;
+        im->head_len = ARCHIVE_HEADER_LEN;
+        LOG_INFO(FS, "\nimport: receiving %u bytes\n", (unsigned int) total);
+    }
+
+    if (im->owner != request) return;
+
+    im->touched_ms = millis();
+    archiveImportFeed(data, len);
+}
+
+void archiveImportRequest(AsyncWebServerRequest* request) {
+    ARCHIVE_STREAM* im = &archive_import;
+    char response[96];
+
+    if (im->owner != request) {
+        request->send(503, "application/json", "{\"error\":\"import already running or no body\"}");
+        return;
+    }
+
+    short code = 200;
+    if (im->error != NULL) {
+        code = 400;
+        snprintf(response, sizeof(response), "{\"error\":\"%s\",\"applied\":%d}", im->error, im->applied);
+    } else if (im->phase != ARCHIVE_DONE) {
+        code = 400;
+        snprintf(response, sizeof(response), "{\"error\":\"truncated archive\",\"applied\":%d}", im->applied);
+    } else {
+        snprintf(response, sizeof(response), "{\"applied\":%d,\"failed\":%d}", im->applied, im->failed);
+    }
+
+    if (im->file) {
+        im->file.close();
+        LittleFS.remove(ARCHIVE_IMPORT_TMP);
+    }
+    archiveRelease(im);
+
+    request->send(code, "application/json", response);
+    LOG_INFO(FS, "%s handled: %s\n", request->url().c_str(), response);
+}
+
+void wireArchive() {
+    server.on("/api/export", HTTP_GET, archiveExportRequest);
+    server.on("/api/import", HTTP_POST, archiveImportRequest, NULL, archiveImportBody);
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// deferred binary logging (build with -D LOG_BINARY)
+//
+// the leveled LOG_* macros store their format string in flash and write a
+// small record into the TelnetSpy ring instead of formatting on the device:
+//
+//   0x1E  argc  fmt address (u32)  micros (u32)  args...
+//
+// every arg is a tag byte followed by its raw value, all little endian:
+//
+//   'i' u32   integers, enums and pointers up to 32 bits
+//   'l' u64   64 bit integers
+//   'd' f64   float / double
+//   's' u16 length + bytes   strings, cut at BINLOG_STR_MAX
+//
+// a record is built in a stack buffer sized from its argument types and
+// handed to SerialAndTelnet with a single write().
+//
+// the format address is the id. tools/log_decoder.py looks it up in the
+// firmware ELF and renders the text on the host. everything outside a
+// record (LOG_PRINT, LOG_PRINTLN, os_printf) passes through as plain text.
+// binlog_enabled switches back to on-device formatting at runtime.
+
+#include <type_traits>
+
+#define BINLOG_MARK     0x1E
+#define BINLOG_HEADER   10          // mark, argc, fmt address, micros
+#define BINLOG_STR_MAX  64          // longer string args are cut
+
+bool binlog_enabled = true;
+
+// largest encoding of one arg, so a record's buffer size is known at compile time
+template<typename T>
+struct binlog_arg_size {
+    static const size_t value = 1 + ((std::is_floating_point<T>::value || (!std::is_pointer<T>::value && sizeof(T) > 4)) ? 8 : 4);
+};
+
+template<>
+struct binlog_arg_size<const char*> {
+    static const size_t value = 1 + 2 + BINLOG_STR_MAX;
+};
+
+template<>
+struct binlog_arg_size<char*> : binlog_arg_size<const char*> {};
+
+template<typename... Args>
+struct binlog_size {
+    static const size_t value = BINLOG_HEADER;
+};
+
+template<typename T, typename... Rest>
+struct binlog_size<T, Rest...> {
+    static const size_t value = binlog_arg_size<T>::value + binlog_size<Rest...>::value;
+};
+
+typedef struct binlog_writer {
+    uint8_t* buf;               // sized by binlog_size, never overrun
+    size_t len;
+} BINLOG_WRITER;
+
+void binlogPut(BINLOG_WRITER* w, const void* data, size_t len) {
+    memcpy(&w->buf[w->len], data, len);
+    w->len += len;
+}
+
+void binlogTag(BINLOG_WRITER* w, char tag, const void* value, size_t len) {
+    binlogPut(w, &tag, 1);
+    binlogPut(w, value, len);
+}
+
+template<typename T>
+typename std::enable_if<(std::is_integral<T>::value || std::is_enum<T>::value) && sizeof(T) <= 4>::type
+binlogArg(BINLOG_WRITER* w, T v) {
+    const uint32_t u = (uint32_t) v;
+    binlogTag(w, 'i', &u, sizeof(u));
+}
+
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 8>::type
+binlogArg(BINLOG_WRITER* w, T v) {
+    const uint64_t u = (uint64_t) v;
+    binlogTag(w, 'l', &u, sizeof(u));
+}
+
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+binlogArg(BINLOG_WRITER* w, T v) {
+    const double d = v;
+    binlogTag(w, 'd', &d, sizeof(d));
+}
+
+void binlogArg(BINLOG_WRITER* w, const char* s) {
+    const uint16_t len = s == NULL ? 0 : strnlen(s, BINLOG_STR_MAX);
+    binlogTag(w, 's', &len, sizeof(len));
+    binlogPut(w, s, len);
+}
+
+void binlogArg(BINLOG_WRITER* w, char* s) {
+    binlogArg(w, (const char*) s);
+}
+
+template<typename T>
+void binlogArg(BINLOG_WRITER* w, T* p) {
+    const uint32_t u = (uint32_t) (uintptr_t) p;
+    binlogTag(w, 'i', &u, sizeof(u));
+}
+
+template<typename... Args>
+void binlogWrite(const char* fmt, Args... args) {
+    if (!binlog_enabled) {
+        logPrintf_P(fmt, args...);
+        return;
+    }
+
+    uint8_t buf[binlog_size<Args...>::value];
+    BINLOG_WRITER w = { buf, 2 };
+    buf[0] = BINLOG_MARK;
+    buf[1] = sizeof...(args);
+
+    const uint32_t id = (uint32_t) (uintptr_t) fmt;
+    const uint32_t ts = micros();
+    binlogPut(&w, &id, sizeof(id));
+    binlogPut(&w, &ts, sizeof(ts));
+
+    // every arg writes exactly one tagged value
+    (void) std::initializer_list<int>{ 0, (binlogArg(&w, args), 0)... };
+
+    // one write, so a record never interleaves with output from another task
+    SerialAndTelnet.write(buf, w.len);
+}
+
+#define BINLOG_PRINTF(fmt, ...) do { static const char binlog_fmt[] PROGMEM = fmt; binlogWrite(binlog_fmt, ##__VA_ARGS__); } while (0)
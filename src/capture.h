@@ -0,0 +1,87 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// IR capture queue
+//
+// the receiver runs from the first milliseconds of setup(), long before the
+// file system and the network are up. decoded captures are handed to the
+// RAM consumers (api, push) right away and queued here; captureFlush()
+// appends them to /signals.txt and /last_signal.txt from a scheduler task
+// once LittleFS is mounted, as many per pass as its time budget allows.
+// when the queue is full the oldest capture is dropped.
+
+#define CAPTURE_QUEUE_LEN       8
+
+typedef struct capture_entry {
+    uint16_t* raw;              // from resultToRawArray(), freed after the flush
+    uint16_t rawlen;
+    uint64_t ts_us;             // formatted on flush, after NTP may have synced
+} CAPTURE_ENTRY;
+
+CAPTURE_ENTRY capture_queue[CAPTURE_QUEUE_LEN];
+uint8_t capture_head = 0;
+uint8_t capture_tail = 0;
+uint32_t capture_dropped = 0;
+bool capture_fs_ready = false;
+
+void captureQueue(decode_results* results) {
+    PROFILE_SPAN("capture queue");
+
+    if ((uint8_t) (capture_head - capture_tail) >= CAPTURE_QUEUE_LEN) {
+        free(capture_queue[capture_tail % CAPTURE_QUEUE_LEN].raw);
+        capture_tail++;
+        capture_dropped++;
+        LOG_WARN(IR, "capture queue full -- oldest capture dropped\n");
+    }
+
+    CAPTURE_ENTRY* entry = &capture_queue[capture_head % CAPTURE_QUEUE_LEN];
+    entry->raw = resultToRawArray(results);
+    entry->rawlen = results->rawlen;
+    entry->ts_us = timeNowUs();
+    capture_head++;
+
+    if (LOG_ENABLED(LOG_LEVEL_DEBUG, IR)) {
+        // appended, a long capture would not fit one formatted line
+        LOG_LINE line;
+        logLineBegin(&line);
+        logStr(&line, "IRrecv: [");
+        logStr(&line, (char*) entry->raw);
+        logStr(&line, "]\n");
+        logFlush(&line);
+    }
+}
+
+// persists queued captures while the task budget lasts, true if any are left
+bool captureFlush() {
+    if (!capture_fs_ready) return false;
+
+    while (capture_head != capture_tail) {
+        PROFILE_SPAN("capture write");
+        CAPTURE_ENTRY* entry = &capture_queue[capture_tail % CAPTURE_QUEUE_LEN];
+        char ts[TIME_TEXT_LEN];
+
+        File file = LittleFS.open("/signals.txt", FILE_APPEND);
+        file.printf("%s: [%s]\n", timeFormat(entry->ts_us, ts, sizeof(ts)), (char*) entry->raw);
+        file.close();
+
+        file = LittleFS.open("/last_signal.txt", FILE_WRITE);
+        file.write((char*) entry->raw, entry->rawlen);
+        file.close();
+
+        free(entry->raw);
+        entry->raw = NULL;
+        capture_tail++;
+        heartbeat(HB_PERSIST);
+
+        if (!schedulerBudgetLeft()) break;
+    }
+
+    // an empty queue has nothing to be stuck on
+    if (capture_head == capture_tail) heartbeat(HB_PERSIST);
+    return capture_head != capture_tail;
+}
@@ -8,27 +8,83 @@ as published by Sam Hocevar. See the COPYING file for more details.
 #include <TelnetSpy.h>
 TelnetSpy SerialAndTelnet;
 
+#include "log_line.h"
+
+// log levels
+//
+// LOG_LEVEL_<MODULE> are compile time thresholds (e.g. -D LOG_LEVEL_IR=LOG_LEVEL_TRACE),
+// calls above them compile to nothing and never evaluate their arguments.
+// log_level is the runtime threshold and can be changed from the console.
+#define LOG_LEVEL_NONE       0
+#define LOG_LEVEL_ERROR      1
+#define LOG_LEVEL_WARN       2
+#define LOG_LEVEL_INFO       3
+#define LOG_LEVEL_DEBUG      4
+#define LOG_LEVEL_TRACE      5
+
+#ifndef LOG_LEVEL
 #ifdef ENABLE_DEBUG
+#define LOG_LEVEL            LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL            LOG_LEVEL_WARN
+#endif
+#endif
+
+#ifndef LOG_LEVEL_CORE
+#define LOG_LEVEL_CORE       LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_WIFI
+#define LOG_LEVEL_WIFI       LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_HTTP
+#define LOG_LEVEL_HTTP       LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_IR
+#define LOG_LEVEL_IR         LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_OTA
+#define LOG_LEVEL_OTA        LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_FS
+#define LOG_LEVEL_FS         LOG_LEVEL
+#endif
+
+uint8_t log_level = LOG_LEVEL;
+
+// the serial / telnet console is part of every build
 #define LOG_BEGIN(baudrate)  SerialAndTelnet.begin(baudrate)
-#define LOG_PRINT(...)       SerialAndTelnet.print(__VA_ARGS__)
-#define LOG_PRINTLN(...)     SerialAndTelnet.println(__VA_ARGS__)
-#define LOG_PRINTF(...)      SerialAndTelnet.printf(__VA_ARGS__)
-#define LOG_HANDLE()         SerialAndTelnet.handle() ; checkForRemoteCommand()
+#define LOG_HANDLE()         SerialAndTelnet.handle() ; shellPoll()
 #define LOG_FLUSH()          SerialAndTelnet.flush()
 #define LOG_WELCOME_MSG(msg) SerialAndTelnet.setWelcomeMsg(msg)
+#define CONSOLE_PRINT(...)   SerialAndTelnet.print(__VA_ARGS__)
+#define CONSOLE_PRINTLN(...) SerialAndTelnet.println(__VA_ARGS__)
+#define CONSOLE_PRINTF(...)  logPrintf(__VA_ARGS__)
+
+#ifdef LOG_BINARY
+#include "binlog.h"
+#define LOG_FORMAT(fmt, ...) BINLOG_PRINTF(fmt, ##__VA_ARGS__)
 #else
-#define LOG_BEGIN(baudrate)
-#define LOG_PRINT(...) 
-#define LOG_PRINTLN(...)
-#define LOG_PRINTF(...) 
-#define LOG_HANDLE()
-#define LOG_FLUSH()
-#define LOG_WELCOME_MSG(msg)
+#define LOG_FORMAT(...)      logPrintf(__VA_ARGS__)
 #endif
 
+#define LOG_ENABLED(level, module)  ((level) <= LOG_LEVEL_##module && (level) <= log_level)
+#define LOG_AT(level, module, ...)  do { if (LOG_ENABLED(level, module)) LOG_FORMAT(__VA_ARGS__); } while (0)
+#define LOG_ERROR(module, ...)      LOG_AT(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define LOG_WARN(module, ...)       LOG_AT(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define LOG_INFO(module, ...)       LOG_AT(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define LOG_DEBUG(module, ...)      LOG_AT(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#define LOG_TRACE(module, ...)      LOG_AT(LOG_LEVEL_TRACE, module, __VA_ARGS__)
+
+// unleveled output is core debug output
+#define LOG_PRINT(...)       do { if (LOG_ENABLED(LOG_LEVEL_DEBUG, CORE)) SerialAndTelnet.print(__VA_ARGS__); } while (0)
+#define LOG_PRINTLN(...)     do { if (LOG_ENABLED(LOG_LEVEL_DEBUG, CORE)) SerialAndTelnet.println(__VA_ARGS__); } while (0)
+#define LOG_PRINTF(...)      LOG_DEBUG(CORE, __VA_ARGS__)
+
 #define WATCHDOG_TIMEOUT_S 15
 volatile bool timer_pinged;
 
+void crashlogWatchdog();     // crashlog.h
+
 #include <Arduino.h>
 #include <ArduinoOTA.h>
 #include "time.h"
@@ -48,6 +104,7 @@ hw_timer_t* watchDogTimer = NULL;
 void IRAM_ATTR watchDogInterrupt() {
     LOG_PRINTLN("watchdog triggered reboot");
     LOG_FLUSH();
+    crashlogWatchdog();
     ESP.restart();
 }
 #else
@@ -70,6 +127,7 @@ void IRAM_ATTR TimerHandler() {
     if (timer_pinged) {
         LOG_PRINTLN("watchdog triggered reboot");
         LOG_FLUSH();
+        crashlogWatchdog();
         ESP.restart();
     } else {
         timer_pinged = true;
@@ -112,26 +170,23 @@ void IRAM_ATTR TimerHandler() {
 #define LED_OFF  { digitalWrite(2, HIGH); }
 #endif
 
-#define EEPROM_SIZE 256
-#define HOSTNAME_LEN 32
-#define WIFI_SSID_LEN 32
-#define WIFI_PASSWD_LEN 64
-
-#define DEFAULT_HOSTNAME            "lolin-ir-blaster"
+// state shared with web server callbacks: on esp32 they run in the AsyncTCP
+// task next to loop(), on esp8266 from the sys context between loop() passes
+#ifdef esp32
+#define WEB_LOCK_DECLARE(lock)  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED
+#define WEB_LOCK(lock)          portENTER_CRITICAL(&lock)
+#define WEB_UNLOCK(lock)        portEXIT_CRITICAL(&lock)
+#else
+#define WEB_LOCK_DECLARE(lock)  uint8_t lock __attribute__((unused))
+#define WEB_LOCK(lock)          do { } while (0)
+#define WEB_UNLOCK(lock)        do { } while (0)
+#endif
 
-#define CFG_NOT_SET                 0x0
-#define CFG_SET                     0x9
+#include "config_type.h"
 
-typedef unsigned char tiny_int;
+#define DEFAULT_HOSTNAME            "lolin-ir-blaster"
 
-typedef struct config_type {
-    tiny_int hostname_flag;
-    char hostname[HOSTNAME_LEN];
-    tiny_int ssid_flag;
-    char ssid[WIFI_SSID_LEN];
-    tiny_int ssid_pwd_flag;
-    char ssid_pwd[WIFI_PASSWD_LEN];
-} CONFIG_TYPE;
+#define WIFI_FAST_CONNECT_MS        8000
 
 CONFIG_TYPE config;
 
@@ -139,6 +194,7 @@ void watchDogRefresh();
 void blink();
 
 void wireConfig();
+void wifiCacheStore();
 void wireWebServerAndPaths();
 void wireArduinoOTA(const char* hostname);
 
@@ -146,21 +202,31 @@ void onOTAStart();
 void onOTAProgress(size_t current, size_t final);
 void onOTAEnd(bool success);
 
-void updateHtmlTemplate(String template_filename, bool showTime);
+void updateHtmlTemplate(const char* template_filename, bool showTime);
 
-#ifdef ENABLE_DEBUG 
-void checkForRemoteCommand();
-#endif
+void shellPoll();
 
-void saveConfig(String hostname,
-                String ssid,
-                String ssid_pwd);
+void saveConfig(const char* hostname,
+                const char* ssid,
+                const char* ssid_pwd);
 
 void wipeConfig();
 
-String getTimestamp();
-boolean isNumeric(String str);
+boolean isNumeric(const char* str);
 void printHeapStats();
+bool heapSoakStep();
+void cmdHeap(int argc, char** argv);
+
+typedef enum boot_stage {
+    BOOT_IR = 0,
+    BOOT_FS,                // mounts LittleFS and loads the config
+    BOOT_WIFI,
+    BOOT_OTA,
+    BOOT_HTTP,
+    BOOT_WATCHDOG,
+    BOOT_READY
+} BOOT_STAGE;
+#define BOOT_STAGES (BOOT_READY + 1)
 
 WiFiMode_t wifimode = WIFI_AP;
 
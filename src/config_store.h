@@ -0,0 +1,325 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// journaled config store
+//
+// the config lives in /config.jnl on LittleFS as a log of key / value
+// records: key, length, value and a CRC-16 per record. the first record
+// carries a magic and the schema version. on boot the log is replayed once
+// into the config struct, every read after that is a plain struct read.
+//
+// configStoreSave() compares the struct with what was written last and
+// appends only the keys that changed, an empty value clears a key. the log
+// is rewritten as a snapshot only when it would grow past CONFIG_JOURNAL_MAX;
+// the snapshot goes to a temp file first and is renamed over the log. a
+// record cut short by a reset fails its CRC, the replay stops there and the
+// log is compacted right away.
+//
+// schema 1 is the raw struct at EEPROM offset 0. devices coming from it are
+// migrated on first boot, the EEPROM copy is only ever read.
+
+#define CONFIG_JOURNAL          "/config.jnl"
+#define CONFIG_JOURNAL_TMP      "/config.tmp"
+#define CONFIG_JOURNAL_MAX      1024
+#define CONFIG_MAGIC            0x314A4643UL    // "CFJ1"
+#define CONFIG_SCHEMA           2
+#define CONFIG_VALUE_MAX        64
+
+typedef enum config_key {
+    CFG_KEY_SCHEMA = 0,     // magic + version, first record only
+    CFG_KEY_HOSTNAME,
+    CFG_KEY_SSID,
+    CFG_KEY_SSID_PWD,
+    CFG_KEY_WIFI_CACHE,     // bssid, channel, ip, gateway, subnet, dns
+    CFG_KEYS
+} CONFIG_KEY;
+
+#define CFG_WIFI_CACHE_LEN      23
+
+CONFIG_TYPE config_stored;          // what the journal holds
+bool config_store_ready = false;    // set once LittleFS is mounted
+uint16_t config_schema = 0;         // version the config was loaded from
+uint32_t config_journal_size = 0;
+uint32_t config_compactions = 0;
+
+uint16_t configCrc(uint16_t crc, const uint8_t* data, size_t len) {
+    // CRC-16/CCITT-FALSE
+    while (len--) {
+        crc ^= (uint16_t) *data++ << 8;
+        for (tiny_int i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+uint8_t configStringGet(tiny_int flag, const char* field, size_t size, uint8_t* value) {
+    if (flag != CFG_SET) return 0;
+    const uint8_t len = strnlen(field, size - 1);
+    memcpy(value, field, len);
+    return len;
+}
+
+// encodes one key of c into value, returns its length, 0 => not set
+uint8_t configKeyGet(const CONFIG_TYPE* c, tiny_int key, uint8_t* value) {
+    switch (key) {
+    case CFG_KEY_HOSTNAME:
+        return configStringGet(c->hostname_flag, c->hostname, HOSTNAME_LEN, value);
+    case CFG_KEY_SSID:
+        return configStringGet(c->ssid_flag, c->ssid, WIFI_SSID_LEN, value);
+    case CFG_KEY_SSID_PWD:
+        return configStringGet(c->ssid_pwd_flag, c->ssid_pwd, WIFI_PASSWD_LEN, value);
+    case CFG_KEY_WIFI_CACHE:
+        if (c->wifi_cache_flag != CFG_SET) return 0;
+        memcpy(value, c->wifi_bssid, 6);
+        value[6] = c->wifi_channel;
+        memcpy(value + 7, &c->wifi_ip, 4);
+        memcpy(value + 11, &c->wifi_gateway, 4);
+        memcpy(value + 15, &c->wifi_subnet, 4);
+        memcpy(value + 19, &c->wifi_dns, 4);
+        return CFG_WIFI_CACHE_LEN;
+    }
+    return 0;
+}
+
+void configStringSet(tiny_int* flag, char* field, size_t size, const uint8_t* value, uint8_t len) {
+    memset(field, CFG_NOT_SET, size);
+    if (len > size - 1) len = size - 1;
+    memcpy(field, value, len);
+    *flag = len > 0 ? CFG_SET : CFG_NOT_SET;
+}
+
+// applies one journal record to c, unknown keys are skipped
+void configKeySet(CONFIG_TYPE* c, tiny_int key, const uint8_t* value, uint8_t len) {
+    switch (key) {
+    case CFG_KEY_HOSTNAME:
+        configStringSet(&c->hostname_flag, c->hostname, HOSTNAME_LEN, value, len);
+        break;
+    case CFG_KEY_SSID:
+        configStringSet(&c->ssid_flag, c->ssid, WIFI_SSID_LEN, value, len);
+        break;
+    case CFG_KEY_SSID_PWD:
+        configStringSet(&c->ssid_pwd_flag, c->ssid_pwd, WIFI_PASSWD_LEN, value, len);
+        break;
+    case CFG_KEY_WIFI_CACHE:
+        if (len != CFG_WIFI_CACHE_LEN) {
+            c->wifi_cache_flag = CFG_NOT_SET;
+            break;
+        }
+        memcpy(c->wifi_bssid, value, 6);
+        c->wifi_channel = value[6];
+        memcpy(&c->wifi_ip, value + 7, 4);
+        memcpy(&c->wifi_gateway, value + 11, 4);
+        memcpy(&c->wifi_subnet, value + 15, 4);
+        memcpy(&c->wifi_dns, value + 19, 4);
+        c->wifi_cache_flag = CFG_SET;
+        break;
+    }
+}
+
+size_t configWriteRecord(File& file, tiny_int key, const uint8_t* value, uint8_t len) {
+    uint8_t head[2] = { key, len };
+    const uint16_t crc = configCrc(configCrc(0xFFFF, head, 2), value, len);
+    uint8_t tail[2] = { (uint8_t) (crc & 0xFF), (uint8_t) (crc >> 8) };
+
+    size_t written = file.write(head, 2);
+    written += file.write(value, len);
+    written += file.write(tail, 2);
+    return written;
+}
+
+// false at the end of the log or on a damaged record
+bool configReadRecord(File& file, tiny_int* key, uint8_t* value, uint8_t* len) {
+    uint8_t head[2];
+    uint8_t tail[2];
+
+    if (file.read(head, 2) != 2) return false;
+    if (head[1] > CONFIG_VALUE_MAX || file.read(value, head[1]) != head[1] || file.read(tail, 2) != 2) return false;
+
+    const uint16_t crc = configCrc(configCrc(0xFFFF, head, 2), value, head[1]);
+    if (crc != (uint16_t) (tail[0] | (tail[1] << 8))) return false;
+
+    *key = head[0];
+    *len = head[1];
+    return true;
+}
+
+void configWriteHeader(File& file) {
+    uint8_t header[6];
+    const uint32_t magic = CONFIG_MAGIC;
+    const uint16_t schema = CONFIG_SCHEMA;
+    memcpy(header, &magic, 4);
+    memcpy(header + 4, &schema, 2);
+    config_journal_size = configWriteRecord(file, CFG_KEY_SCHEMA, header, sizeof(header));
+}
+
+// rewrites the log as one record per set key
+bool configStoreCompact() {
+    uint8_t value[CONFIG_VALUE_MAX];
+
+    File file = LittleFS.open(CONFIG_JOURNAL_TMP, FILE_WRITE);
+    if (!file) {
+        LOG_ERROR(FS, "\nconfig: unable to create %s\n", CONFIG_JOURNAL_TMP);
+        return false;
+    }
+
+    configWriteHeader(file);
+    for (tiny_int key = CFG_KEY_SCHEMA + 1; key < CFG_KEYS; key++) {
+        const uint8_t len = configKeyGet(&config, key, value);
+        if (len > 0) config_journal_size += configWriteRecord(file, key, value, len);
+    }
+    file.close();
+
+    if (!LittleFS.rename(CONFIG_JOURNAL_TMP, CONFIG_JOURNAL)) {
+        LOG_ERROR(FS, "\nconfig: unable to replace %s\n", CONFIG_JOURNAL);
+        return false;
+    }
+
+    memcpy(&config_stored, &config, sizeof(config));
+    config_compactions++;
+    LOG_DEBUG(FS, "config: journal compacted to %u bytes\n", (unsigned int) config_journal_size);
+    return true;
+}
+
+// appends the keys that differ from the journal
+bool configStoreSave() {
+    uint8_t value[CONFIG_VALUE_MAX];
+    uint8_t stored[CONFIG_VALUE_MAX];
+    uint8_t lens[CFG_KEYS] = { 0 };
+    bool changed[CFG_KEYS] = { false };
+    size_t needed = 0;
+
+    if (!config_store_ready) {
+        LOG_ERROR(FS, "\nconfig: file system not mounted -- not saved\n");
+        return false;
+    }
+
+    for (tiny_int key = CFG_KEY_SCHEMA + 1; key < CFG_KEYS; key++) {
+        lens[key] = configKeyGet(&config, key, value);
+        const uint8_t stored_len = configKeyGet(&config_stored, key, stored);
+        changed[key] = lens[key] != stored_len || memcmp(value, stored, lens[key]) != 0;
+        if (changed[key]) needed += lens[key] + 4;
+    }
+    if (needed == 0) return true;
+
+    if (config_journal_size + needed > CONFIG_JOURNAL_MAX) return configStoreCompact();
+
+    File file = LittleFS.open(CONFIG_JOURNAL, FILE_APPEND);
+    if (!file) {
+        LOG_ERROR(FS, "\nconfig: unable to open %s\n", CONFIG_JOURNAL);
+        return false;
+    }
+    for (tiny_int key = CFG_KEY_SCHEMA + 1; key < CFG_KEYS; key++) {
+        if (!changed[key]) continue;
+        configKeyGet(&config, key, value);
+        config_journal_size += configWriteRecord(file, key, value, lens[key]);
+    }
+    file.close();
+
+    memcpy(&config_stored, &config, sizeof(config));
+    LOG_DEBUG(FS, "config: %u bytes appended, journal at %u bytes\n", (unsigned int) needed, (unsigned int) config_journal_size);
+    return true;
+}
+
+// for a config read from somewhere untrusted: flags are set or not set,
+// strings are terminated. erased flash reads back as 0xff
+void configSanitize(CONFIG_TYPE* c) {
+    if (c->hostname_flag != CFG_SET) c->hostname_flag = CFG_NOT_SET;
+    if (c->ssid_flag != CFG_SET) c->ssid_flag = CFG_NOT_SET;
+    if (c->ssid_pwd_flag != CFG_SET) c->ssid_pwd_flag = CFG_NOT_SET;
+    if (c->wifi_cache_flag != CFG_SET) c->wifi_cache_flag = CFG_NOT_SET;
+    c->hostname[HOSTNAME_LEN - 1] = '\0';
+    c->ssid[WIFI_SSID_LEN - 1] = '\0';
+    c->ssid_pwd[WIFI_PASSWD_LEN - 1] = '\0';
+}
+
+// schema 1: the raw struct at EEPROM offset 0
+void configReadEeprom(CONFIG_TYPE* c) {
+    EEPROM.begin(EEPROM_SIZE);
+    EEPROM.get(0, *c);
+    EEPROM.end();
+    configSanitize(c);
+}
+
+// brings a config loaded with an older schema up to date, one step per case
+void configMigrate(uint16_t from) {
+    switch (from) {
+    case 1:
+        configReadEeprom(&config);
+        LOG_INFO(FS, "config: migrated from EEPROM\n");
+        // fall through
+    default:
+        break;
+    }
+    configStoreCompact();
+}
+
+// replays the journal into config, false if there is none
+bool configReplay() {
+    uint8_t value[CONFIG_VALUE_MAX];
+    tiny_int key;
+    uint8_t len;
+
+    File file = LittleFS.open(CONFIG_JOURNAL, FILE_READ);
+    if (!file) return false;
+
+    uint32_t magic = 0;
+    if (configReadRecord(file, &key, value, &len) && key == CFG_KEY_SCHEMA && len >= 6) {
+        memcpy(&magic, value, 4);
+        memcpy(&config_schema, value + 4, 2);
+    }
+    if (magic != CONFIG_MAGIC) {
+        LOG_WARN(FS, "config: %s has no valid header\n", CONFIG_JOURNAL);
+        file.close();
+        return false;
+    }
+    config_journal_size = file.position();
+
+    while (configReadRecord(file, &key, value, &len)) {
+        configKeySet(&config, key, value, len);
+        config_journal_size = file.position();
+    }
+    const bool torn = config_journal_size < file.size();
+    file.close();
+
+    memcpy(&config_stored, &config, sizeof(config));
+    if (torn) {
+        LOG_WARN(FS, "config: damaged record at %u -- compacting\n", (unsigned int) config_journal_size);
+        configStoreCompact();
+    }
+    return true;
+}
+
+// loads config from the journal, migrating older schemas
+void configStoreLoad() {
+    memset(&config, CFG_NOT_SET, sizeof(config));
+    memset(&config_stored, CFG_NOT_SET, sizeof(config_stored));
+    config_journal_size = 0;
+
+    if (!config_store_ready) {
+        // no file system, run from the EEPROM copy without saving
+        configReadEeprom(&config);
+        config_schema = 1;
+        return;
+    }
+
+    if (!configReplay()) config_schema = 1;
+    if (config_schema < CONFIG_SCHEMA) configMigrate(config_schema);
+}
+
+void cmdConfigStore(int argc, char** argv) {
+    if (argc > 1 && strcasecmp(argv[1], "compact") == 0) {
+        CONSOLE_PRINTLN(configStoreCompact() ? "\nConfig journal compacted" : "\nConfig journal compaction failed");
+        return;
+    }
+    CONSOLE_PRINTF("\nschema: %u (loaded as %u)\njournal: %u of %u bytes\ncompactions: %u\n",
+        (unsigned int) CONFIG_SCHEMA, (unsigned int) config_schema, (unsigned int) config_journal_size,
+        (unsigned int) CONFIG_JOURNAL_MAX, (unsigned int) config_compactions);
+}
+
+void wireConfigStore() {
+    shellRegister("config", "Config Journal Stats [compact]", cmdConfigStore);
+}
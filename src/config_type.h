@@ -0,0 +1,43 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// the persisted config, kept free of Arduino headers so the host tests
+// (test/) can build config_store.h against it
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEPROM_SIZE 256
+#define HOSTNAME_LEN 32
+#define WIFI_SSID_LEN 32
+#define WIFI_PASSWD_LEN 64
+
+#define CFG_NOT_SET                 0x0
+#define CFG_SET                     0x9
+
+typedef unsigned char tiny_int;
+
+typedef struct config_type {
+    tiny_int hostname_flag;
+    char hostname[HOSTNAME_LEN];
+    tiny_int ssid_flag;
+    char ssid[WIFI_SSID_LEN];
+    tiny_int ssid_pwd_flag;
+    char ssid_pwd[WIFI_PASSWD_LEN];
+    // last good access point for a direct connect, cleared whenever the ssid changes
+    tiny_int wifi_cache_flag;
+    uint8_t wifi_bssid[6];
+    uint8_t wifi_channel;
+    uint32_t wifi_ip;               // last lease, only used with WIFI_CACHE_LEASE
+    uint32_t wifi_gateway;
+    uint32_t wifi_subnet;
+    uint32_t wifi_dns;
+} CONFIG_TYPE;
+
+// configs saved before the wifi cache existed end here
+#define CONFIG_BASE_LEN             offsetof(CONFIG_TYPE, wifi_cache_flag)
@@ -0,0 +1,196 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// crash surviving log
+//
+// everything written through TelnetSpy is also copied into a small ring
+// together with the reason of the next reboot. the ring survives soft resets:
+// on esp32 it lives in RTC_NOINIT memory, on esp8266 it is kept in RAM and
+// copied into RTC user memory on every restart path and from
+// custom_crash_callback. nothing touches flash on the way down. blocks 0-31
+// of RTC user memory hold the eboot command Update.end() leaves for the
+// bootloader, so the record starts at block 32 and gets the remaining 384
+// bytes -- writing over the command would throw away a finished OTA update.
+//
+// after boot the previous ring is available from the crashlog console command
+// and GET /api/crashlog.
+
+#define CRASHLOG_MAGIC          0x4C524331UL    // "1CRL"
+#define CRASHLOG_DETAIL_LEN     24
+#ifdef esp32
+#define CRASHLOG_TEXT_LEN       2008
+#else
+#define CRASHLOG_TEXT_LEN       348             // 384 bytes above the eboot command
+#define CRASHLOG_RTC_BLOCK      32
+#endif
+
+typedef enum crash_reason {
+    CRASH_NONE = 0,
+    CRASH_REQUESTED,
+    CRASH_WATCHDOG,
+    CRASH_WIFI,
+    CRASH_AP_IDLE,
+    CRASH_OTA,
+    CRASH_EXCEPTION,
+    CRASH_STALL
+} CRASH_REASON;
+
+typedef struct crash_log {
+    uint32_t magic;
+    uint32_t uptime_ms;
+    uint16_t head;
+    uint8_t reason;
+    uint8_t wrapped;
+    char detail[CRASHLOG_DETAIL_LEN];
+    char text[CRASHLOG_TEXT_LEN];
+} CRASH_LOG;
+
+static_assert(sizeof(CRASH_LOG) % 4 == 0, "crash log must be whole 32 bit words");
+#ifndef esp32
+static_assert(sizeof(CRASH_LOG) <= 384, "crash log must fit into RTC user memory above the eboot command");
+#endif
+
+#ifdef esp32
+RTC_NOINIT_ATTR CRASH_LOG crash_live;
+#else
+CRASH_LOG crash_live;
+#endif
+CRASH_LOG crash_prev;
+
+const char* crashlogReasonName(uint8_t reason) {
+    switch (reason) {
+        case CRASH_REQUESTED:   return "requested";
+        case CRASH_WATCHDOG:    return "watchdog";
+        case CRASH_WIFI:        return "wifi lost";
+        case CRASH_AP_IDLE:     return "ap idle";
+        case CRASH_OTA:         return "ota update";
+        case CRASH_EXCEPTION:   return "exception";
+        case CRASH_STALL:       return "stalled";
+        default:                return "unknown";
+    }
+}
+
+// TelnetSpy write tap -- keeps the youngest bytes
+void crashlogTap(const uint8_t* data, size_t len) {
+    if (crash_live.magic != CRASHLOG_MAGIC) return;
+
+    if (len > CRASHLOG_TEXT_LEN) {
+        data += len - CRASHLOG_TEXT_LEN;
+        len = CRASHLOG_TEXT_LEN;
+    }
+
+    const size_t first = min(len, (size_t) (CRASHLOG_TEXT_LEN - crash_live.head));
+    memcpy(&crash_live.text[crash_live.head], data, first);
+    memcpy(crash_live.text, data + first, len - first);
+
+    if (crash_live.head + len >= CRASHLOG_TEXT_LEN) crash_live.wrapped = true;
+    crash_live.head = (crash_live.head + len) % CRASHLOG_TEXT_LEN;
+}
+
+// records why the next reboot happens, the latest note wins
+void crashlogNote(uint8_t reason, const char* detail) {
+    crash_live.reason = reason;
+    strncpy(crash_live.detail, detail, CRASHLOG_DETAIL_LEN - 1);
+    crash_live.detail[CRASHLOG_DETAIL_LEN - 1] = '\0';
+}
+
+// called right before a restart, must not allocate or touch flash
+void crashlogPersist() {
+    crash_live.uptime_ms = millis();
+    if (crash_live.reason == CRASH_NONE) crash_live.reason = CRASH_REQUESTED;
+#ifndef esp32
+    ESP.rtcUserMemoryWrite(CRASHLOG_RTC_BLOCK, (uint32_t*) &crash_live, sizeof(crash_live));
+#endif
+}
+
+void crashlogWatchdog() {
+    // a heartbeat stall already named the subsystem, else name the running task
+    if (crash_live.reason != CRASH_STALL) crashlogNote(CRASH_WATCHDOG, sched_current != NULL ? sched_current->name : "loop stalled");
+    crashlogPersist();
+}
+
+#ifndef esp32
+extern "C" void custom_crash_callback(struct rst_info* rst_info, uint32_t stack, uint32_t stack_end) {
+    char detail[CRASHLOG_DETAIL_LEN];
+    snprintf(detail, sizeof(detail), "exccause %u @%08x", (unsigned int) rst_info->exccause, (unsigned int) rst_info->epc1);
+    crashlogNote(CRASH_EXCEPTION, detail);
+    crashlogPersist();
+}
+#endif
+
+void crashlogDump(Print& out) {
+#ifdef esp32
+    out.printf("reset reason: %d\n", (int) esp_reset_reason());
+#else
+    out.printf("reset reason: %s\n", ESP.getResetReason().c_str());
+#endif
+
+    if (crash_prev.magic != CRASHLOG_MAGIC) {
+        out.print("no log from the previous boot\n");
+        return;
+    }
+
+    out.printf("last reboot: %s%s%s after %lu ms\n\n", crashlogReasonName(crash_prev.reason),
+        crash_prev.detail[0] ? " - " : "", crash_prev.detail, (unsigned long) crash_prev.uptime_ms);
+
+    if (crash_prev.wrapped) {
+        // start at the first complete line
+        size_t start = crash_prev.head;
+        for (size_t i = 0; i < CRASHLOG_TEXT_LEN; i++) {
+            if (crash_prev.text[(crash_prev.head + i) % CRASHLOG_TEXT_LEN] == '\n') {
+                start = (crash_prev.head + i + 1) % CRASHLOG_TEXT_LEN;
+                break;
+            }
+        }
+        if (start >= crash_prev.head) {
+            out.write((const uint8_t*) &crash_prev.text[start], CRASHLOG_TEXT_LEN - start);
+            start = 0;
+        }
+        out.write((const uint8_t*) &crash_prev.text[start], crash_prev.head - start);
+    } else {
+        out.write((const uint8_t*) crash_prev.text, crash_prev.head);
+    }
+    out.print("\n");
+}
+
+// first thing in setup(): pick up the previous boot's log and start a new one
+void crashlogBegin() {
+#ifdef esp32
+    memcpy(&crash_prev, &crash_live, sizeof(crash_prev));
+#else
+    ESP.rtcUserMemoryRead(CRASHLOG_RTC_BLOCK, (uint32_t*) &crash_prev, sizeof(crash_prev));
+#endif
+    if (crash_prev.head >= CRASHLOG_TEXT_LEN) crash_prev.magic = 0;
+    crash_prev.detail[CRASHLOG_DETAIL_LEN - 1] = '\0';
+
+    memset(&crash_live, 0, sizeof(crash_live));
+    crash_live.magic = CRASHLOG_MAGIC;
+#ifndef esp32
+    // a power cycle or hardware reset must not replay this boot's log
+    const uint32_t invalid = 0;
+    ESP.rtcUserMemoryWrite(CRASHLOG_RTC_BLOCK, (uint32_t*) &invalid, sizeof(invalid));
+#endif
+
+    SerialAndTelnet.setCallbackOnWrite(crashlogTap);
+}
+
+void cmdCrashLog(int argc, char** argv) {
+    CONSOLE_PRINTLN("\nPrevious Boot Log\n");
+    crashlogDump(SerialAndTelnet);
+}
+
+void wireCrashLog() {
+    server.on("/api/crashlog", HTTP_GET, [](AsyncWebServerRequest* request)
+        {
+            AsyncResponseStream* response = request->beginResponseStream("text/plain");
+            crashlogDump(*response);
+            request->send(response);
+        });
+
+    shellRegister("crashlog", "Previous Boot Log", cmdCrashLog);
+}
@@ -0,0 +1,117 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// subsystem heartbeats
+//
+// every subsystem calls heartbeat() from the code that proves it still makes
+// progress. a subsystem is armed once it is up and from then on must beat
+// within its own deadline. watchDogRefresh() feeds the hardware timer only
+// while heartbeatHealthy(), so one stuck subsystem starves the watchdog even
+// if the rest of the loop keeps going. the first stalled name goes into the
+// crash log as the reboot reason.
+//
+// what counts as progress:
+//   ir       a capture was decoded, or no queued send is overdue
+//   web      housekeeping ran and gave back expired leases (admissionReclaim),
+//            the server itself runs outside the loop
+//   telnet   TelnetSpy handle() returned, it never waits on a client
+//   wifi     the link is up, the soft AP has an address, or the link state
+//            machine is still inside the time its current state may take
+//   persist  a queued capture was written, or the queue is empty
+//
+// OTA uploads block the loop on purpose; their progress callbacks suspend the
+// check for one watchdog period at a time.
+
+typedef enum heartbeat_id {
+    HB_IR = 0,
+    HB_WEB,
+    HB_TELNET,
+    HB_WIFI,
+    HB_PERSIST,
+    HEARTBEATS
+} HEARTBEAT_ID;
+
+const char* const heartbeat_names[HEARTBEATS] = { "ir", "web", "telnet", "wifi", "persist" };
+const uint32_t heartbeat_deadlines_ms[HEARTBEATS] = { 2000, 10000, 5000, 10000, 10000 };
+
+typedef struct heartbeat_state {
+    bool armed;
+    uint32_t last_ms;
+    uint32_t worst_ms;          // longest gap between two beats
+} HEARTBEAT_STATE;
+
+HEARTBEAT_STATE heartbeats[HEARTBEATS];
+int8_t heartbeat_stalled = -1;
+bool heartbeat_suspended = false;
+uint32_t heartbeat_suspend_ms = 0;
+
+void heartbeat(HEARTBEAT_ID id) {
+    const uint32_t now = millis();
+    HEARTBEAT_STATE* hb = &heartbeats[id];
+    if (hb->armed && now - hb->last_ms > hb->worst_ms) hb->worst_ms = now - hb->last_ms;
+    hb->last_ms = now;
+}
+
+void heartbeatArm(HEARTBEAT_ID id) {
+    heartbeats[id].armed = true;
+    heartbeats[id].last_ms = millis();
+}
+
+void heartbeatSuspend() {
+    heartbeat_suspended = true;
+    heartbeat_suspend_ms = millis();
+}
+
+// false while an armed subsystem is past its deadline
+bool heartbeatHealthy() {
+    const uint32_t now = millis();
+
+    if (heartbeat_suspended) {
+        if (now - heartbeat_suspend_ms < WATCHDOG_TIMEOUT_S * 1000UL) return true;
+        heartbeat_suspended = false;
+        // everyone was blocked by the upload, start over
+        for (tiny_int i = 0; i < HEARTBEATS; i++) heartbeats[i].last_ms = now;
+    }
+
+    for (tiny_int i = 0; i < HEARTBEATS; i++) {
+        if (!heartbeats[i].armed || now - heartbeats[i].last_ms <= heartbeat_deadlines_ms[i]) continue;
+
+        if (heartbeat_stalled != i) {
+            heartbeat_stalled = i;
+            LOG_ERROR(CORE, "\nheartbeat: %s stalled for %lu ms -- watchdog no longer fed\n",
+                heartbeat_names[i], (unsigned long) (now - heartbeats[i].last_ms));
+            crashlogNote(CRASH_STALL, heartbeat_names[i]);
+        }
+        return false;
+    }
+
+    if (heartbeat_stalled >= 0) {
+        LOG_WARN(CORE, "\nheartbeat: %s recovered\n", heartbeat_names[heartbeat_stalled]);
+        if (crash_live.reason == CRASH_STALL) crashlogNote(CRASH_NONE, "");
+        heartbeat_stalled = -1;
+    }
+    return true;
+}
+
+void cmdHeartbeat(int argc, char** argv) {
+    const uint32_t now = millis();
+
+    CONSOLE_PRINTLN("\nsubsystem  deadline ms  last ms  worst ms");
+    for (tiny_int i = 0; i < HEARTBEATS; i++) {
+        if (!heartbeats[i].armed) {
+            CONSOLE_PRINTF("%-10s %11lu  not armed\n", heartbeat_names[i], (unsigned long) heartbeat_deadlines_ms[i]);
+            continue;
+        }
+        CONSOLE_PRINTF("%-10s %11lu  %7lu  %8lu\n", heartbeat_names[i], (unsigned long) heartbeat_deadlines_ms[i],
+            (unsigned long) (now - heartbeats[i].last_ms), (unsigned long) heartbeats[i].worst_ms);
+    }
+}
+
+void wireHeartbeat() {
+    shellRegister("heartbeat", "Subsystem Heartbeats", cmdHeartbeat);
+}
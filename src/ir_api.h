@@ -0,0 +1,533 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// JSON REST API for IR learn / send
+//
+// POST /api/ir/send   body is a single command or an array of commands:
+//
+//   { "protocol": "NEC", "value": "0x20DF10EF", "bits": 32, "repeat": 0, "gap": 100 }
+//   { "raw": [9000, 4500, 560, 560, ...], "khz": 38, "repeat": 1, "gap": 40 }
+//   [ { ... }, { ... } ]
+//
+// "gap" is the number of ms to wait after a command (and between repeats of a
+// raw command) before the next one is sent. Commands are queued and sent from
+// loop() so the request returns immediately.
+//
+// GET /api/ir/learn?timeout=<seconds>   long-polls for the next capture
+//
+// The request body is parsed as it arrives by a small streaming parser with a
+// fixed token buffer, so the body is never buffered in a String.
+
+#define IR_API_MAX_COMMANDS         16
+#define IR_API_RAW_POOL             600
+#define IR_API_MAX_BODY             8192
+#define IR_API_BODY_TIMEOUT_MS      5000
+#define IR_API_TOKEN_LEN            24
+#define IR_API_MAX_DEPTH            6
+#define IR_API_DEFAULT_KHZ          38
+#define IR_API_LEARN_RAW_MAX        512
+#define IR_API_LEARN_TIMEOUT_S      20
+#define IR_API_LEARN_MAX_TIMEOUT_S  60
+#define IR_API_SEND_LATE_MS         1000
+
+typedef struct ir_command {
+    decode_type_t protocol;
+    uint64_t value;
+    uint16_t bits;
+    uint16_t khz;
+    uint16_t repeat;
+    uint16_t gap_ms;
+    uint16_t raw_offset;
+    uint16_t raw_len;
+} IR_COMMAND;
+
+typedef enum {
+    IR_JSON_VALUE,          // expecting a value
+    IR_JSON_KEY,            // expecting a key or the end of an object
+    IR_JSON_COLON,          // expecting ':' after a key
+    IR_JSON_NEXT,           // expecting ',' or the end of a container
+    IR_JSON_STRING,         // inside a string
+    IR_JSON_ESCAPE,         // inside a string after '\'
+    IR_JSON_LITERAL,        // inside a number / true / false / null
+    IR_JSON_DONE,           // top level value complete
+    IR_JSON_ERROR
+} IR_JSON_STATE;
+
+typedef struct ir_json_parser {
+    IR_JSON_STATE state;
+    bool string_is_key;
+    char stack[IR_API_MAX_DEPTH];           // '{' or '['
+    tiny_int depth;
+    tiny_int cmd_depth;                     // depth of the command objects
+    bool in_command;
+    bool in_raw;
+    char key[IR_API_TOKEN_LEN];
+    char token[IR_API_TOKEN_LEN];
+    tiny_int token_len;
+    const char* error;
+} IR_JSON_PARSER;
+
+typedef enum {
+    IR_API_IDLE,            // nothing queued, a request may claim the queue
+    IR_API_PARSING,         // a request body is being parsed into the queue
+    IR_API_SENDING          // loop() is working through the queue
+} IR_API_STATE;
+
+IR_JSON_PARSER ir_json;
+IR_COMMAND ir_commands[IR_API_MAX_COMMANDS];
+uint16_t ir_raw_pool[IR_API_RAW_POOL];
+tiny_int ir_command_count = 0;
+uint16_t ir_raw_used = 0;
+
+volatile IR_API_STATE ir_api_state = IR_API_IDLE;
+AsyncWebServerRequest* ir_api_owner = NULL;
+unsigned long ir_api_fed_ms = 0;
+
+tiny_int ir_send_index = 0;
+uint16_t ir_send_repeat = 0;
+unsigned long ir_send_due = 0;
+
+// most recent capture for /api/ir/learn
+volatile uint32_t ir_capture_seq = 0;
+decode_type_t ir_capture_protocol = UNKNOWN;
+uint64_t ir_capture_value = 0;
+uint16_t ir_capture_bits = 0;
+uint16_t ir_capture_raw[IR_API_LEARN_RAW_MAX];
+uint16_t ir_capture_raw_len = 0;
+
+void irJsonReset() {
+    memset(&ir_json, 0, sizeof(ir_json));
+    ir_json.state = IR_JSON_VALUE;
+    ir_command_count = 0;
+    ir_raw_used = 0;
+}
+
+void irJsonFail(const char* error) {
+    if (ir_json.state != IR_JSON_ERROR) {
+        ir_json.state = IR_JSON_ERROR;
+        ir_json.error = error;
+    }
+}
+
+void irJsonBeginCommand() {
+    if (ir_command_count >= IR_API_MAX_COMMANDS) {
+        irJsonFail("too many commands");
+        return;
+    }
+
+    IR_COMMAND* cmd = &ir_commands[ir_command_count];
+    memset(cmd, 0, sizeof(IR_COMMAND));
+    cmd->protocol = UNKNOWN;
+    cmd->khz = IR_API_DEFAULT_KHZ;
+    cmd->raw_offset = ir_raw_used;
+    ir_json.in_command = true;
+}
+
+void irJsonEndCommand() {
+    IR_COMMAND* cmd = &ir_commands[ir_command_count];
+    ir_json.in_command = false;
+
+    if (cmd->raw_len == 0) {
+        if (cmd->protocol == UNKNOWN) {
+            irJsonFail("command needs a protocol or raw timings");
+            return;
+        }
+        if (cmd->bits == 0) cmd->bits = IRsend::defaultBits(cmd->protocol);
+    }
+
+    ir_command_count++;
+}
+
+void irJsonScalar(bool quoted) {
+    if (!ir_json.in_command) {
+        irJsonFail("expected a command or an array of commands");
+        return;
+    }
+
+    IR_COMMAND* cmd = &ir_commands[ir_command_count];
+    const char* token = ir_json.token;
+
+    if (ir_json.in_raw) {
+        if (ir_json.depth != ir_json.cmd_depth + 1) return;
+        if (quoted) {
+            irJsonFail("raw timings must be numbers");
+        } else if (ir_raw_used >= IR_API_RAW_POOL) {
+            irJsonFail("too many raw timings");
+        } else {
+            ir_raw_pool[ir_raw_used++] = (uint16_t) strtoul(token, NULL, 10);
+            cmd->raw_len++;
+        }
+        return;
+    }
+
+    if (ir_json.depth != ir_json.cmd_depth) return;
+
+    if (strcmp(ir_json.key, "protocol") == 0) {
+        cmd->protocol = strToDecodeType(token);
+        if (cmd->protocol == UNKNOWN) irJsonFail("unknown protocol");
+    } else if (strcmp(ir_json.key, "value") == 0) {
+        cmd->value = strtoull(token, NULL, 0);
+    } else if (strcmp(ir_json.key, "bits") == 0) {
+        cmd->bits = (uint16_t) strtoul(token, NULL, 0);
+    } else if (strcmp(ir_json.key, "khz") == 0 || strcmp(ir_json.key, "carrier") == 0) {
+        cmd->khz = (uint16_t) strtoul(token, NULL, 0);
+        // accept a carrier given in Hz
+        if (cmd->khz > 1000) cmd->khz /= 1000;
+    } else if (strcmp(ir_json.key, "repeat") == 0) {
+        cmd->repeat = (uint16_t) strtoul(token, NULL, 0);
+    } else if (strcmp(ir_json.key, "gap") == 0) {
+        cmd->gap_ms = (uint16_t) strtoul(token, NULL, 0);
+    }
+}
+
+void irJsonOpen(char c) {
+    if (ir_json.depth >= IR_API_MAX_DEPTH) {
+        irJsonFail("nesting too deep");
+        return;
+    }
+
+    // the top level value decides where the commands live
+    if (ir_json.depth == 0) ir_json.cmd_depth = (c == '{') ? 1 : 2;
+
+    if (!ir_json.in_command) {
+        if (c == '{' && ir_json.depth + 1 == ir_json.cmd_depth) {
+            irJsonBeginCommand();
+        } else if (ir_json.depth != 0) {
+            irJsonFail("expected a command or an array of commands");
+        }
+    } else if (c == '[' && ir_json.depth == ir_json.cmd_depth && strcmp(ir_json.key, "raw") == 0) {
+        ir_json.in_raw = true;
+    }
+    if (ir_json.state == IR_JSON_ERROR) return;
+
+    ir_json.stack[ir_json.depth++] = c;
+    ir_json.state = (c == '{') ? IR_JSON_KEY : IR_JSON_VALUE;
+}
+
+void irJsonClose(char c) {
+    if (ir_json.depth == 0 || ir_json.stack[ir_json.depth - 1] != (c == '}' ? '{' : '[')) {
+        irJsonFail("mismatched bracket");
+        return;
+    }
+
+    ir_json.depth--;
+    if (c == ']' && ir_json.in_raw && ir_json.depth == ir_json.cmd_depth) {
+        ir_json.in_raw = false;
+    } else if (c == '}' && ir_json.in_command && ir_json.depth + 1 == ir_json.cmd_depth) {
+        irJsonEndCommand();
+    }
+    if (ir_json.state == IR_JSON_ERROR) return;
+
+    ir_json.state = ir_json.depth == 0 ? IR_JSON_DONE : IR_JSON_NEXT;
+}
+
+void irJsonEndToken(bool quoted) {
+    ir_json.token[ir_json.token_len] = 0;
+    ir_json.token_len = 0;
+
+    if (ir_json.string_is_key) {
+        strcpy(ir_json.key, ir_json.token);
+        ir_json.state = IR_JSON_COLON;
+        return;
+    }
+
+    irJsonScalar(quoted);
+    if (ir_json.state != IR_JSON_ERROR) ir_json.state = ir_json.depth == 0 ? IR_JSON_DONE : IR_JSON_NEXT;
+}
+
+void irJsonTokenChar(char c) {
+    if (ir_json.token_len >= IR_API_TOKEN_LEN - 1) {
+        irJsonFail("token too long");
+        return;
+    }
+    ir_json.token[ir_json.token_len++] = c;
+}
+
+void irJsonFeed(const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len && ir_json.state != IR_JSON_ERROR; i++) {
+        const char c = (char) data[i];
+
+        switch (ir_json.state) {
+        case IR_JSON_STRING:
+            if (c == '"') {
+                irJsonEndToken(true);
+            } else if (c == '\\') {
+                ir_json.state = IR_JSON_ESCAPE;
+            } else {
+                irJsonTokenChar(c);
+            }
+            continue;
+        case IR_JSON_ESCAPE:
+            irJsonTokenChar(c);
+            ir_json.state = IR_JSON_STRING;
+            continue;
+        case IR_JSON_LITERAL:
+            if (isalnum(c) || c == '.' || c == '-' || c == '+') {
+                irJsonTokenChar(c);
+                continue;
+            }
+            irJsonEndToken(false);
+            if (ir_json.state == IR_JSON_ERROR) continue;
+            // the terminating character still needs to be handled
+            break;
+        default:
+            break;
+        }
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+
+        switch (ir_json.state) {
+        case IR_JSON_VALUE:
+            if (c == '{' || c == '[') {
+                irJsonOpen(c);
+            } else if (c == ']' && ir_json.depth > 0 && ir_json.stack[ir_json.depth - 1] == '[') {
+                irJsonClose(c);
+            } else if (c == '"') {
+                ir_json.string_is_key = false;
+                ir_json.state = IR_JSON_STRING;
+            } else if (isalnum(c) || c == '-') {
+                ir_json.state = IR_JSON_LITERAL;
+                irJsonTokenChar(c);
+            } else {
+                irJsonFail("expected a value");
+            }
+            break;
+        case IR_JSON_KEY:
+            if (c == '"') {
+                ir_json.string_is_key = true;
+                ir_json.state = IR_JSON_STRING;
+            } else if (c == '}') {
+                irJsonClose(c);
+            } else {
+                irJsonFail("expected a key");
+            }
+            break;
+        case IR_JSON_COLON:
+            if (c == ':') {
+                ir_json.string_is_key = false;
+                ir_json.state = IR_JSON_VALUE;
+            } else {
+                irJsonFail("expected ':'");
+            }
+            break;
+        case IR_JSON_NEXT:
+            if (c == ',') {
+                ir_json.state = ir_json.stack[ir_json.depth - 1] == '{' ? IR_JSON_KEY : IR_JSON_VALUE;
+            } else if (c == '}' || c == ']') {
+                irJsonClose(c);
+            } else {
+                irJsonFail("expected ',' or end of container");
+            }
+            break;
+        case IR_JSON_DONE:
+            irJsonFail("trailing data");
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool irJsonFinish() {
+    // a bare top level number is only terminated by the end of the body
+    if (ir_json.state == IR_JSON_LITERAL) irJsonEndToken(false);
+
+    if (ir_json.state == IR_JSON_ERROR) return false;
+    if (ir_json.state != IR_JSON_DONE) {
+        irJsonFail("incomplete body");
+        return false;
+    }
+    if (ir_command_count == 0) {
+        irJsonFail("no commands");
+        return false;
+    }
+    return true;
+}
+
+void irApiCapture(decode_results* capture) {
+    ir_capture_protocol = capture->decode_type;
+    ir_capture_value = capture->value;
+    ir_capture_bits = capture->bits;
+
+    // rawbuf[0] is the leading gap, the rest are mark / space ticks
+    uint16_t len = 0;
+    for (uint16_t i = 1; i < capture->rawlen && len < IR_API_LEARN_RAW_MAX; i++) {
+        uint32_t usecs = capture->rawbuf[i] * kRawTick;
+        ir_capture_raw[len++] = usecs > UINT16_MAX ? UINT16_MAX : (uint16_t) usecs;
+    }
+    ir_capture_raw_len = len;
+
+    ir_capture_seq++;
+}
+
+void irApiLoop() {
+    if (ir_api_state != IR_API_SENDING || (long) (millis() - ir_send_due) < 0) return;
+
+    if (ir_send_index >= ir_command_count) {
+        LOG_INFO(IR, "IRsend: api queue of %d command(s) complete\n", ir_command_count);
+        ir_api_state = IR_API_IDLE;
+        return;
+    }
+
+    IR_COMMAND* cmd = &ir_commands[ir_send_index];
+
+    irrecv.pause();
+    if (cmd->raw_len > 0) {
+        irsend.sendRaw(&ir_raw_pool[cmd->raw_offset], cmd->raw_len, cmd->khz);
+        LOG_DEBUG(IR, "IRsend: api raw [%d timings @ %d kHz]\n", cmd->raw_len, cmd->khz);
+    } else {
+        // protocol repeats are handled by the protocol encoder itself
+        const bool sent = irsend.send(cmd->protocol, cmd->value, cmd->bits, cmd->repeat);
+        LOG_DEBUG(IR, "IRsend: api %s [%s / %d bits] %s\n", typeToString(cmd->protocol).c_str(), uint64ToString(cmd->value, 16).c_str(), cmd->bits, sent ? "sent" : "not supported");
+        ir_send_repeat = cmd->repeat;
+    }
+    irrecv.resume();
+
+    if (ir_send_repeat < cmd->repeat) {
+        ir_send_repeat++;
+    } else {
+        ir_send_index++;
+        ir_send_repeat = 0;
+    }
+    ir_send_due = millis() + cmd->gap_ms;
+}
+
+// queued commands waiting well past their due time, the send task is stuck
+bool irApiOverdue() {
+    return ir_api_state == IR_API_SENDING && (long) (millis() - ir_send_due) > (long) IR_API_SEND_LATE_MS;
+}
+
+void irApiSendBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+    if (index == 0) {
+        // a body that stalled (client went away mid upload) gives up the queue
+        if (ir_api_state == IR_API_PARSING && (ir_api_owner == request || millis() - ir_api_fed_ms > IR_API_BODY_TIMEOUT_MS)) {
+            ir_api_owner = NULL;
+            ir_api_state = IR_API_IDLE;
+        }
+
+        if (ir_api_state != IR_API_IDLE || total > IR_API_MAX_BODY) return;
+
+        ir_api_state = IR_API_PARSING;
+        ir_api_owner = request;
+        irJsonReset();
+    }
+
+    if (ir_api_owner == request) {
+        ir_api_fed_ms = millis();
+        irJsonFeed(data, len);
+    }
+}
+
+void irApiSendRequest(AsyncWebServerRequest* request) {
+    char response[96];
+
+    if (ir_api_owner != request) {
+        if (request->contentLength() == 0 || request->contentLength() > IR_API_MAX_BODY) {
+            request->send(400, "application/json", "{\"error\":\"body missing or too large\"}");
+        } else {
+            request->send(503, "application/json", "{\"error\":\"busy\"}");
+        }
+        LOG_WARN(HTTP, "\n%s rejected\n", request->url().c_str());
+        return;
+    }
+
+    ir_api_owner = NULL;
+
+    if (!irJsonFinish()) {
+        snprintf(response, sizeof(response), "{\"error\":\"%s\"}", ir_json.error);
+        ir_api_state = IR_API_IDLE;
+        request->send(400, "application/json", response);
+        LOG_WARN(HTTP, "\n%s rejected: %s\n", request->url().c_str(), ir_json.error);
+        return;
+    }
+
+    ir_send_index = 0;
+    ir_send_repeat = 0;
+    ir_send_due = millis();
+    ir_api_state = IR_API_SENDING;
+
+    snprintf(response, sizeof(response), "{\"queued\":%d}", ir_command_count);
+    request->send(202, "application/json", response);
+    LOG_DEBUG(HTTP, "\n%s handled\n", request->url().c_str());
+}
+
+void irApiLearnRequest(AsyncWebServerRequest* request) {
+    unsigned long timeout_s = IR_API_LEARN_TIMEOUT_S;
+    if (request->hasParam("timeout")) {
+        timeout_s = request->getParam("timeout")->value().toInt();
+        if (timeout_s > IR_API_LEARN_MAX_TIMEOUT_S) timeout_s = IR_API_LEARN_MAX_TIMEOUT_S;
+    }
+
+    const uint32_t start_seq = ir_capture_seq;
+    const unsigned long deadline = millis() + timeout_s * 1000UL;
+    uint32_t seq = 0;
+    tiny_int phase = 0;
+    uint16_t raw_idx = 0;
+
+    // RESPONSE_TRY_AGAIN keeps the connection open until a capture shows up
+    AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+        [start_seq, deadline, seq, phase, raw_idx](uint8_t* buffer, size_t maxLen, size_t index) mutable -> size_t
+        {
+            char* out = (char*) buffer;
+            size_t used = 0;
+
+            if (phase == 0) {
+                if (ir_capture_seq == start_seq) {
+                    if ((long) (millis() - deadline) < 0) return RESPONSE_TRY_AGAIN;
+                    static const char timeout[] = "{\"timeout\":true}";
+                    if (maxLen < sizeof(timeout)) return RESPONSE_TRY_AGAIN;
+                    phase = 3;
+                    memcpy(out, timeout, sizeof(timeout) - 1);
+                    return sizeof(timeout) - 1;
+                }
+
+                // formatted aside, the chunk may be too small for all of it
+                char header[160];
+                const uint32_t capture_seq = ir_capture_seq;
+                const int n = snprintf(header, sizeof(header), "{\"seq\":%u,\"protocol\":\"%s\",\"value\":\"0x%s\",\"bits\":%d,\"khz\":%d,\"raw\":[",
+                    (unsigned int) capture_seq, typeToString(ir_capture_protocol).c_str(), uint64ToString(ir_capture_value, 16).c_str(), ir_capture_bits, IR_API_DEFAULT_KHZ);
+                if (n < 0 || (size_t) n >= sizeof(header) || (size_t) n >= maxLen) return RESPONSE_TRY_AGAIN;
+
+                seq = capture_seq;
+                memcpy(out, header, n);
+                used = n;
+                phase = 1;
+            }
+
+            if (phase == 1) {
+                while (raw_idx < ir_capture_raw_len && used < maxLen && seq == ir_capture_seq) {
+                    const int n = snprintf(out + used, maxLen - used, raw_idx == 0 ? "%u" : ",%u", ir_capture_raw[raw_idx]);
+                    // a value that did not fit completely goes into the next chunk
+                    if (n < 0 || used + n >= maxLen) break;
+                    used += n;
+                    raw_idx++;
+                }
+                if (raw_idx >= ir_capture_raw_len || seq != ir_capture_seq) phase = 2;
+            }
+
+            if (phase == 2 && used < maxLen) {
+                const int n = snprintf(out + used, maxLen - used, seq == ir_capture_seq ? "]}" : "],\"truncated\":true}");
+                if (n >= 0 && used + n < maxLen) {
+                    used += n;
+                    phase = 3;
+                }
+            }
+
+            if (used == 0) return phase == 3 ? 0 : RESPONSE_TRY_AGAIN;
+            return used;
+        });
+
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+    LOG_DEBUG(HTTP, "\n%s handled\n", request->url().c_str());
+}
+
+void wireIrApi() {
+    server.on("/api/ir/send", HTTP_POST, irApiSendRequest, NULL, irApiSendBody);
+    server.on("/api/ir/learn", HTTP_GET, irApiLearnRequest);
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// live IR capture push over a WebSocket at /api/ir/ws
+//
+// every decoded capture is rendered once into a small frame ring. each
+// subscriber keeps its own cursor into that ring and is fed from loop() while
+// its websocket queue has room. a subscriber that falls more than
+// IR_PUSH_FRAMES behind skips its oldest frames instead of growing a queue.
+//
+// on esp32 the websocket events run in the AsyncTCP task, which also deletes
+// a client right after its disconnect event, while irPushLoop() looks clients
+// up and sends to them from loop(). both hold ir_push_mutex, so a client is
+// never freed while loop() uses it. a (recursive) mutex rather than a
+// spinlock: sending may block on the tcpip thread. on esp8266 the events run
+// between loop() passes and the lock is a no-op.
+
+#define IR_PUSH_FRAMES          8
+#define IR_PUSH_FRAME_LEN       160
+#define IR_PUSH_MAX_CLIENTS     4
+#define IR_PUSH_MAX_INFLIGHT    2
+
+#ifdef esp32
+SemaphoreHandle_t ir_push_mutex = NULL;
+#define IR_PUSH_LOCK()          xSemaphoreTakeRecursive(ir_push_mutex, portMAX_DELAY)
+#define IR_PUSH_UNLOCK()        xSemaphoreGiveRecursive(ir_push_mutex)
+#else
+#define IR_PUSH_LOCK()          do { } while (0)
+#define IR_PUSH_UNLOCK()        do { } while (0)
+#endif
+
+typedef struct ir_push_client {
+    uint32_t id;            // 0 => slot unused
+    uint32_t cursor;        // sequence number of the next frame to send
+    uint32_t dropped;       // frames skipped because the client was too slow
+} IR_PUSH_CLIENT;
+
+AsyncWebSocket ir_ws("/api/ir/ws");
+
+char ir_push_frames[IR_PUSH_FRAMES][IR_PUSH_FRAME_LEN];
+volatile uint32_t ir_push_head = 0;
+IR_PUSH_CLIENT ir_push_clients[IR_PUSH_MAX_CLIENTS];
+
+void irPushCapture(decode_results* capture) {
+    const uint32_t seq = ir_push_head;
+    char ts[TIME_TEXT_LEN];
+
+    snprintf(ir_push_frames[seq % IR_PUSH_FRAMES], IR_PUSH_FRAME_LEN,
+        "{\"seq\":%u,\"ts\":\"%s\",\"protocol\":\"%s\",\"value\":\"0x%s\",\"bits\":%d,\"rawlen\":%d}",
+        (unsigned int) seq, timeFormat(timeNowUs(), ts, sizeof(ts)), typeToString(capture->decode_type).c_str(),
+        uint64ToString(capture->value, 16).c_str(), capture->bits, capture->rawlen);
+
+    ir_push_head = seq + 1;
+}
+
+void irPushEvent(AsyncWebSocket* ws, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len) {
+    if (type != WS_EVT_CONNECT && type != WS_EVT_DISCONNECT) return;
+
+    // a disconnecting client is deleted as soon as this returns, any client,
+    // subscribed or not, waits until loop() is done with the list
+    IR_PUSH_LOCK();
+    if (type == WS_EVT_CONNECT) {
+        tiny_int i = 0;
+        while (i < IR_PUSH_MAX_CLIENTS && ir_push_clients[i].id != 0) i++;
+        if (i < IR_PUSH_MAX_CLIENTS) {
+            // only frames captured from now on
+            ir_push_clients[i].cursor = ir_push_head;
+            ir_push_clients[i].dropped = 0;
+            ir_push_clients[i].id = client->id();
+            LOG_INFO(HTTP, "\nws client %u subscribed\n", (unsigned int) client->id());
+        } else {
+            client->close(1013, "too many subscribers");
+        }
+    } else {
+        for (tiny_int i = 0; i < IR_PUSH_MAX_CLIENTS; i++) {
+            if (ir_push_clients[i].id == client->id()) {
+                LOG_INFO(HTTP, "\nws client %u unsubscribed - %u frame(s) dropped\n", (unsigned int) client->id(), (unsigned int) ir_push_clients[i].dropped);
+                ir_push_clients[i].id = 0;
+            }
+        }
+    }
+    IR_PUSH_UNLOCK();
+}
+
+void irPushLoop() {
+#ifdef esp32
+    // runs from the first loop() pass, wireIrPush() comes with the web server
+    if (ir_push_mutex == NULL) return;
+#endif
+    const uint32_t head = ir_push_head;
+
+    IR_PUSH_LOCK();
+    for (tiny_int i = 0; i < IR_PUSH_MAX_CLIENTS; i++) {
+        IR_PUSH_CLIENT* sub = &ir_push_clients[i];
+        if (sub->id == 0 || sub->cursor == head) continue;
+
+        AsyncWebSocketClient* client = ir_ws.client(sub->id);
+        if (client == NULL || client->status() != WS_CONNECTED) continue;
+
+        // drop the oldest frames when the subscriber has fallen out of the ring
+        if (head - sub->cursor > IR_PUSH_FRAMES) {
+            sub->dropped += head - sub->cursor - IR_PUSH_FRAMES;
+            sub->cursor = head - IR_PUSH_FRAMES;
+        }
+
+        while (sub->cursor != head && client->queueLen() < IR_PUSH_MAX_INFLIGHT) {
+            client->text(ir_push_frames[sub->cursor % IR_PUSH_FRAMES]);
+            sub->cursor++;
+        }
+    }
+
+    ir_ws.cleanupClients(IR_PUSH_MAX_CLIENTS);
+    IR_PUSH_UNLOCK();
+}
+
+void wireIrPush() {
+    memset(ir_push_clients, 0, sizeof(ir_push_clients));
+#ifdef esp32
+    ir_push_mutex = xSemaphoreCreateRecursiveMutex();
+#endif
+    ir_ws.onEvent(irPushEvent);
+    server.addHandler(&ir_ws);
+}
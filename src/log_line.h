@@ -0,0 +1,161 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// stack formatted output
+//
+// Print::printf formats into a 64 byte stack buffer and takes anything longer
+// from the heap, and every '+' of a String concatenation is another heap
+// temporary. over days of uptime both fragment the small esp8266 heap. here
+// output is built in a LOG_LINE on the caller's stack and handed to the
+// target (the TelnetSpy ring unless told otherwise) with a single write():
+//
+//   logPrintf()             printf style, one call formats up to LOG_LINE_LEN
+//   logStr / logU32 / ...   typed appenders, the line is flushed whenever it
+//                           fills up so long values are streamed, never cut
+//
+// the leveled LOG_* macros and CONSOLE_PRINTF go through logPrintf().
+
+#define LOG_LINE_LEN            192
+
+typedef struct log_line {
+    Print* out;
+    uint16_t len;
+    char buf[LOG_LINE_LEN];
+} LOG_LINE;
+
+uint32_t log_truncated = 0;     // logFmt calls cut at LOG_LINE_LEN
+
+void logLineBegin(LOG_LINE* line, Print& out = SerialAndTelnet) {
+    line->out = &out;
+    line->len = 0;
+}
+
+void logFlush(LOG_LINE* line) {
+    if (line->len > 0) line->out->write((const uint8_t*) line->buf, line->len);
+    line->len = 0;
+}
+
+void logChar(LOG_LINE* line, char c) {
+    if (line->len == LOG_LINE_LEN) logFlush(line);
+    line->buf[line->len++] = c;
+}
+
+void logBytes(LOG_LINE* line, const char* data, size_t len) {
+    while (len > 0) {
+        if (line->len == LOG_LINE_LEN) logFlush(line);
+        const size_t n = min(len, (size_t) (LOG_LINE_LEN - line->len));
+        memcpy(&line->buf[line->len], data, n);
+        line->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void logStr(LOG_LINE* line, const char* s) {
+    logBytes(line, s, strlen(s));
+}
+
+// width pads with pad on the left
+void logU32(LOG_LINE* line, uint32_t value, uint8_t width = 0, char pad = ' ', uint8_t base = 10) {
+    char digits[12];
+    uint8_t n = 0;
+    do {
+        const uint8_t d = value % base;
+        digits[n++] = d < 10 ? '0' + d : 'a' + d - 10;
+        value /= base;
+    } while (value > 0);
+
+    while (width > n) {
+        logChar(line, pad);
+        width--;
+    }
+    while (n > 0) logChar(line, digits[--n]);
+}
+
+void logI32(LOG_LINE* line, int32_t value) {
+    if (value < 0) logChar(line, '-');
+    logU32(line, value < 0 ? (uint32_t) -(int64_t) value : (uint32_t) value);
+}
+
+void logHex(LOG_LINE* line, uint32_t value, uint8_t width = 0) {
+    logU32(line, value, width, '0', 16);
+}
+
+void logBool(LOG_LINE* line, bool value) {
+    logStr(line, value ? "true" : "false");
+}
+
+// ipv4 address as stored by IPAddress / lwip, first octet in the low byte
+void logIp(LOG_LINE* line, uint32_t ip) {
+    for (uint8_t i = 0; i < 4; i++) {
+        if (i > 0) logChar(line, '.');
+        logU32(line, (ip >> (8 * i)) & 0xFF);
+    }
+}
+
+// printf arguments for an IPAddress, instead of toString()
+#define LOG_IP_FMT              "%u.%u.%u.%u"
+#define LOG_IP_ARGS(ip)         (unsigned int) (ip)[0], (unsigned int) (ip)[1], (unsigned int) (ip)[2], (unsigned int) (ip)[3]
+
+void logVFmt(LOG_LINE* line, bool progmem, const char* fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int n = progmem ? vsnprintf_P(&line->buf[line->len], LOG_LINE_LEN - line->len, fmt, copy)
+                    : vsnprintf(&line->buf[line->len], LOG_LINE_LEN - line->len, fmt, copy);
+    va_end(copy);
+    if (n < 0) return;
+
+    if (line->len + n >= LOG_LINE_LEN && line->len > 0) {
+        // did not fit behind what is already there, start over in an empty line
+        logFlush(line);
+        n = progmem ? vsnprintf_P(line->buf, LOG_LINE_LEN, fmt, args) : vsnprintf(line->buf, LOG_LINE_LEN, fmt, args);
+        if (n < 0) return;
+    }
+
+    if (line->len + n >= LOG_LINE_LEN) {
+        log_truncated++;
+        line->len = LOG_LINE_LEN - 1;   // vsnprintf wrote a '\0' there
+        line->buf[line->len++] = '\n';
+        return;
+    }
+    line->len += n;
+}
+
+void logFmt(LOG_LINE* line, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void logFmt(LOG_LINE* line, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    logVFmt(line, false, fmt, args);
+    va_end(args);
+}
+
+void logPrintf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void logPrintf(const char* fmt, ...) {
+    LOG_LINE line;
+    logLineBegin(&line);
+
+    va_list args;
+    va_start(args, fmt);
+    logVFmt(&line, false, fmt, args);
+    va_end(args);
+
+    logFlush(&line);
+}
+
+// format string in flash
+void logPrintf_P(PGM_P fmt, ...) {
+    LOG_LINE line;
+    logLineBegin(&line);
+
+    va_list args;
+    va_start(args, fmt);
+    logVFmt(&line, true, fmt, args);
+    va_end(args);
+
+    logFlush(&line);
+}
@@ -9,52 +9,69 @@ as published by Sam Hocevar. See the COPYING file for more details.
 
 void setup() {
   INIT_LED;
-  LOG_WELCOME_MSG("\nLOLIN-IR diagnostics - Press ? for a list of commands\n");
+  crashlogBegin();
+  LOG_WELCOME_MSG("\nLOLIN-IR diagnostics - Type help for a list of commands\n");
   LOG_BEGIN(1500000);
 
   LOG_PRINTLN("\n\nLOLIN-IR Sensor Event Publisher v1.0.0");
 
-  coreSetup();
-
 #if DECODE_HASH
   // Ignore messages with less than minimum on or off pulses.
   irrecv.setUnknownThreshold(MIN_UNKNOWN_SIZE);
 #endif  // DECODE_HASH
 
+  // capture first, the network comes up in the background from loop()
   irrecv.enableIRIn();  // Start the receiver
-  LOG_PRINT("IRrecv is running and waiting for IR input on Pin ");
-  LOG_PRINTLN(RECV_PIN);
+  LOG_INFO(IR, "IRrecv is running and waiting for IR input on Pin %d\n", RECV_PIN);
 
   irsend.begin();
-  LOG_PRINT("IRsend is running and using Pin ");
-  LOG_PRINTLN(IR_LED);
+  LOG_INFO(IR, "IRsend is running and using Pin %d\n", IR_LED);
+  bootMark(BOOT_IR);
+
+  // IR decode is polled again before every other task
+  //            name       task           period ms  prio  budget us
+  schedulerAdd("ir",      taskIrReceive, 0,         0,    2000);
+  schedulerAdd("ir api",  taskIrApi,     0,         1,    2000);
+  schedulerAdd("ir push", taskIrPush,    0,         3,    5000);
+  // persist queued captures once the file system is up
+  schedulerAdd("capture", captureFlush,  0,         3,    20000);
+  heartbeatArm(HB_IR);
+
+  coreSetup();
 
   // LittleFS.remove("/last_signal.txt");
   // LittleFS.remove("/signals.txt");
-
-  // setup done
-  LOG_PRINTLN("\nSystem Ready");
 }
 
-void loop() {
-  coreLoop();
-
+bool taskIrReceive() {
   // Check if the IR code has been received.
   if (irrecv.decode(&results) && !results.repeat && !results.overflow) {
-    uint16_t* rawBuf = resultToRawArray(&results);
-
-    LOG_PRINTF("IRrecv: [%s]\n", (char*)rawBuf);
-
-    File file = LittleFS.open("/signals.txt", FILE_APPEND);
-    file.printf("%s: [%s]\n", getTimestamp().c_str(), (char*)rawBuf);
-    file.close();
+    PROFILE_SPAN("ir capture");
+    irApiCapture(&results);
+    irPushCapture(&results);
+    captureQueue(&results);
+    heartbeat(HB_IR);
+  } else if (!irApiOverdue()) {
+    // nothing received, fine as long as queued sends go out on time
+    heartbeat(HB_IR);
+  }
+  return false;
+}
 
-    file = LittleFS.open("/last_signal.txt", FILE_WRITE);
-    file.write((char*)rawBuf, results.rawlen);
-    file.close();
+bool taskIrApi() {
+  // work through any queued api send requests
+  irApiLoop();
+  return false;
+}
 
-    free(rawBuf);
-  }
+bool taskIrPush() {
+  // push new captures to websocket subscribers
+  irPushLoop();
+  return false;
+}
 
+void loop() {
+  PROFILE_SPAN("loop");
+  coreLoop();
   watchDogRefresh();
 }
@@ -6,32 +6,32 @@ terms of the Do What The Fuck You Want To Public License, Version 2,
 as published by Sam Hocevar. See the COPYING file for more details.
 ****************************************************************************/
 #include "config.h"
+#include "shell.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "time_service.h"
+#include "config_store.h"
+#include "ir_api.h"
+#include "ir_push.h"
+#include "routes.h"
+#include "admission.h"
+#include "archive.h"
+#include "crashlog.h"
+#include "heartbeat.h"
+#include "wifi_link.h"
+#include "capture.h"
+
+const char* const boot_stage_names[] = { "ir", "fs", "wifi", "ota", "http", "watchdog", "ready" };
+unsigned long boot_marks[BOOT_STAGES];
+tiny_int boot_stage = BOOT_IR;
+
+void bootMark(BOOT_STAGE stage) {
+    boot_marks[stage] = millis();
+    boot_stage = stage + 1;
+    LOG_INFO(CORE, "boot: %s up at %lu ms\n", boot_stage_names[stage], boot_marks[stage]);
+}
 
-void coreSetup() {
-    // wire up EEPROM storage and config
-    wireConfig();
-
-    // start and mount our littlefs file system
-    if (!LittleFS.begin()) {
-        LOG_PRINTLN("\nAn Error has occurred while initializing LittleFS\n");
-    } else {
-#ifdef ENABLE_DEBUG
-#ifdef esp32
-        const size_t fs_size = LittleFS.totalBytes() / 1000;
-        const size_t fs_used = LittleFS.usedBytes() / 1000;
-#else
-        FSInfo fs_info;
-        LittleFS.info(fs_info);
-        const size_t fs_size = fs_info.totalBytes / 1000;
-        const size_t fs_used = fs_info.usedBytes / 1000;
-#endif
-        LOG_PRINTLN();
-        LOG_PRINTLN("    Filesystem size: [" + String(fs_size) + "] KB");
-        LOG_PRINTLN("         Free space: [" + String(fs_size - fs_used) + "] KB");
-        LOG_PRINTLN("          Free Heap: [" + String(ESP.getFreeHeap()) + "]");
-#endif
-    }
-
+void bootWifi() {
     // Connect to Wi-Fi network with SSID and password
     // or fall back to AP mode
     WiFi.persistent(false);
@@ -44,7 +44,7 @@ void coreSetup() {
     static const wifi_event_id_t disconnectHandler = WiFi.onEvent([](WiFiEvent_t event)
         {
             if (event == WIFI_DISCONNECTED && !esp_reboot_requested) {
-                LOG_PRINTLN("\nWiFi disconnected");
+                LOG_WARN(WIFI, "\nWiFi disconnected\n");
                 LOG_FLUSH();
                 wifiState = event;
             }
@@ -53,72 +53,59 @@ void coreSetup() {
     static const WiFiEventHandler disconnectHandler = WiFi.onStationModeDisconnected([](WiFiEventStationModeDisconnected event)
         {
             if (!esp_reboot_requested) {
-                LOG_PRINTF("\nWiFi disconnected - reason: %d\n", event.reason);
+                LOG_WARN(WIFI, "\nWiFi disconnected - reason: %d\n", event.reason);
                 LOG_FLUSH();
                 wifiState = WIFI_DISCONNECTED;
             }
         });
 #endif
 
-    // WiFi.scanNetworks will return the number of networks found
-    uint8_t nothing = 0;
-    uint8_t* bestBssid;
-    bestBssid = &nothing;
-    short bestRssi = SHRT_MIN;
-
-    LOG_PRINTLN("\nScanning Wi-Fi networks. . .");
-    int n = WiFi.scanNetworks();
-
-    // arduino is too stupid to know which AP has the best signal
-    // when connecting to an SSID with multiple BSSIDs (WAPs / Repeaters)
-    // so we find the best one and tell it to use it
-    if (n > 0 ) {
-        for (int i = 0; i < n; ++i) {
-            LOG_PRINTF("   ssid: %s - rssi: %d\n", WiFi.SSID(i).c_str(), WiFi.RSSI(i));
-            if (config.ssid_flag == CFG_SET && WiFi.SSID(i).equals(config.ssid) && WiFi.RSSI(i) > bestRssi) {
-                bestRssi = WiFi.RSSI(i);
-                bestBssid = WiFi.BSSID(i);
-            }
-        }
+    // the station link is brought up by wifiLinkLoop() from coreLoop()
+    heartbeatArm(HB_WIFI);
+    if (wifimode == WIFI_STA) {
+        wifiLinkBegin();
+    } else {
+        wifiStartAP();
     }
 
-    if (wifimode == WIFI_STA && bestRssi != SHRT_MIN) {
-        LOG_PRINTF("\nConnecting to %s / %d dB ", config.ssid, bestRssi);
-        WiFi.begin(config.ssid, config.ssid_pwd, 0, bestBssid, true);
-        for (tiny_int x = 0; x < 120 && WiFi.status() != WL_CONNECTED; x++) {
-            blink();
-            LOG_PRINT(".");
-        }
-
-        LOG_PRINTLN();
-
-        if (WiFi.status() == WL_CONNECTED) {
-            // initialize time
-            configTime(0, 0, "pool.ntp.org");
-            setenv("TZ", "EST+5EDT,M3.2.0/2,M11.1.0/2", 1);
-            tzset();
+    LOG_PRINTLN();
+    LOG_PRINT("    Hostname: "); LOG_PRINTLN(config.hostname);
+}
 
-            LOG_PRINT("\nCurrent Time: ");
-            LOG_PRINTLN(getTimestamp());
-        }
+void bootFs() {
+    // start and mount our littlefs file system
+    if (!LittleFS.begin()) {
+        LOG_ERROR(FS, "\nAn Error has occurred while initializing LittleFS\n\n");
+        wireConfig();
+        return;
     }
 
-    if (WiFi.status() != WL_CONNECTED || wifimode == WIFI_AP) {
-        wifimode = WIFI_AP;
-        WiFi.mode(wifimode);
-        WiFi.softAP(config.hostname);
-        dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());
-        LOG_PRINTLN("\nSoftAP [" + String(config.hostname) + "] started");
-    }
+    // the config journal and queued captures can be used from now on
+    config_store_ready = true;
+    wireConfig();
+    capture_fs_ready = true;
+    heartbeatArm(HB_PERSIST);
 
+#ifdef ENABLE_DEBUG
+#ifdef esp32
+    const size_t fs_size = LittleFS.totalBytes() / 1000;
+    const size_t fs_used = LittleFS.usedBytes() / 1000;
+#else
+    FSInfo fs_info;
+    LittleFS.info(fs_info);
+    const size_t fs_size = fs_info.totalBytes / 1000;
+    const size_t fs_used = fs_info.usedBytes / 1000;
+#endif
     LOG_PRINTLN();
-    LOG_PRINT("    Hostname: "); LOG_PRINTLN(config.hostname);
-    LOG_PRINT("Connected to: "); LOG_PRINTLN(wifimode == WIFI_STA ? config.ssid : config.hostname);
-    LOG_PRINT("  IP address: "); LOG_PRINTLN(wifimode == WIFI_STA ? WiFi.localIP().toString() : WiFi.softAPIP().toString());
-    LOG_PRINT("        RSSI: "); LOG_PRINTLN(String(WiFi.RSSI()) + " dB");
+    LOG_PRINTF("    Filesystem size: [%u] KB\n", (unsigned int) fs_size);
+    LOG_PRINTF("         Free space: [%u] KB\n", (unsigned int) (fs_size - fs_used));
+    LOG_PRINTF("          Free Heap: [%u]\n", (unsigned int) ESP.getFreeHeap());
+#endif
+}
 
-    // enable mDNS via espota and enable ota
-    wireArduinoOTA(config.hostname);
+void bootHttp() {
+    // http admission control sees every request first
+    wireAdmission();
 
     // begin Elegant OTA
     ElegantOTA.begin(&server);
@@ -134,7 +121,10 @@ void coreSetup() {
 
     // wire up http server and paths
     wireWebServerAndPaths();
+    heartbeatArm(HB_WEB);
+}
 
+void bootWatchdog() {
     // wire up our custom watchdog
 #ifdef esp32
     watchDogTimer = timerBegin(2, 80, true);
@@ -148,45 +138,86 @@ void coreSetup() {
     LOG_PRINTLN("Watchdog started");
 }
 
-void coreLoop() {
+// brings up the next subsystem, one per loop pass so IR capture keeps running
+void bootStep() {
+    switch (boot_stage) {
+    case BOOT_FS:
+        bootFs();
+        break;
+    case BOOT_WIFI:
+        bootWifi();
+        break;
+    case BOOT_OTA:
+        // enable mDNS via espota and enable ota
+        wireArduinoOTA(config.hostname);
+        break;
+    case BOOT_HTTP:
+        bootHttp();
+        break;
+    case BOOT_WATCHDOG:
+        bootWatchdog();
+        break;
+    case BOOT_READY:
+        LOG_PRINTLN("\nSystem Ready");
+        break;
+    }
+    bootMark((BOOT_STAGE) boot_stage);
+}
+
+void cmdBoot(int argc, char** argv) {
+    CONSOLE_PRINTLN("\nBoot Stages\n");
+    for (tiny_int i = 0; i < BOOT_STAGES; i++) {
+        if (i < boot_stage) {
+            CONSOLE_PRINTF("%10s %6lu ms\n", boot_stage_names[i], boot_marks[i]);
+        } else {
+            CONSOLE_PRINTF("%10s pending\n", boot_stage_names[i]);
+        }
+    }
+    if (wifi_link.ever_up) CONSOLE_PRINTF("%10s %6lu ms\n", "connected", wifi_link.first_up_ms);
+}
+
+// scheduler tasks, see scheduler.h
+bool taskConsole() {
     // handle TelnetSpy if ENABLE_DEBUG is defined
     LOG_HANDLE();
+    // handle() never waits on a client, slow ones get gap markers, so
+    // getting through it is the progress
+    heartbeat(HB_TELNET);
+    return false;
+}
 
-    // handle a reboot request if pending
-    if (esp_reboot_requested) {
-        ElegantOTA.loop();
-        delay(1000);
-        LOG_PRINTLN("\nReboot triggered. . .");
-        LOG_HANDLE();
-        LOG_FLUSH();
-        ESP.restart();
-        while (1) {} // will never get here
-    }
+bool taskBoot() {
+    // bring up the remaining subsystems, one per pass
+    if (boot_stage < BOOT_STAGES) bootStep();
+    return false;
+}
 
+bool taskNetwork() {
     // captive portal if in AP mode
     if (wifimode == WIFI_AP) {
-        dnsServer.processNextRequest();
+        if (boot_stage > BOOT_WIFI) dnsServer.processNextRequest();
+        if ((uint32_t) WiFi.softAPIP() != 0) heartbeat(HB_WIFI);
     } else {
-        if (wifiState == WIFI_DISCONNECTED) {
-            // LOG_PRINTLN("sleeping for 180 seconds. . .");
-            // for (tiny_int x = 0; x < 180; x++) {
-            //   delay(1000);
-            //   watchDogRefresh();
-            // }
-            LOG_PRINTLN("\nRebooting due to no wifi connection");
-            esp_reboot_requested = true;
-            return;
-        }
-
-        // check for OTA
-        ArduinoOTA.handle();
-        ElegantOTA.loop();
+        // reconnects, roams and reboots only after a long outage
+        wifiLinkLoop();
+        if (wifiLinkProgressing()) heartbeat(HB_WIFI);
     }
+    return false;
+}
 
+bool taskOta() {
+    // check for OTA
+    if (wifimode == WIFI_AP) return false;
+    if (boot_stage > BOOT_OTA) ArduinoOTA.handle();
+    if (boot_stage > BOOT_HTTP) ElegantOTA.loop();
+    return false;
+}
 
+bool taskHousekeeping() {
     // reboot if in AP mode and no activity for 5 minutes
-    if (wifimode == WIFI_AP && !ap_mode_activity && millis() >= 300000UL) {
-        LOG_PRINTF("\nNo AP activity for 5 minutes -- triggering reboot");
+    if (wifimode == WIFI_AP && !ap_mode_activity && millis() >= 300000UL && !esp_reboot_requested) {
+        LOG_WARN(WIFI, "\nNo AP activity for 5 minutes -- triggering reboot");
+        crashlogNote(CRASH_AP_IDLE, "");
         esp_reboot_requested = true;
     }
 
@@ -203,9 +234,56 @@ void coreLoop() {
         LOG_PRINTLN("-----  /setup.html rebuilt");
         setup_needs_update = false;
     }
+
+    // a request past its lease lost its disconnect or is a very slow
+    // download, neither is a stall: give the slot back and count it
+    admissionReclaim();
+    heartbeat(HB_WEB);
+    return false;
+}
+
+// the IR receiver is already running, everything else comes up from coreLoop()
+void coreSetup() {
+    // serial / telnet commands
+    wireConsole();
+    wireScheduler();
+    wireHeartbeat();
+    wireWifiLink();
+    shellRegister("boot", "Boot Stage Timestamps", cmdBoot);
+    wireConfigStore();
+
+    //            name       task              period ms  prio  budget us
+    schedulerAdd("console", taskConsole,      0,         1,    5000);
+    schedulerAdd("boot",    taskBoot,         0,         2,    250000);
+    schedulerAdd("network", taskNetwork,      0,         2,    5000);
+    schedulerAdd("ota",     taskOta,          0,         3,    10000);
+    schedulerAdd("house",   taskHousekeeping, 250,       4,    100000);
+    schedulerAdd("clock",   timeRefresh,      1000,      4,    2000);
+    schedulerAdd("soak",    heapSoakStep,     0,         5,    20000);
+    heartbeatArm(HB_TELNET);
+}
+
+void coreLoop() {
+    // handle a reboot request if pending
+    if (esp_reboot_requested) {
+        ElegantOTA.loop();
+        delay(1000);
+        LOG_PRINTLN("\nReboot triggered. . .");
+        LOG_HANDLE();
+        LOG_FLUSH();
+        crashlogPersist();
+        ESP.restart();
+        while (1) {} // will never get here
+    }
+
+    // one pass over everything that is due
+    schedulerRun();
 }
 
 void watchDogRefresh() {
+    // starve the watchdog while any subsystem is stalled
+    if (!heartbeatHealthy()) return;
+
 #ifdef esp32
     timerWrite(watchDogTimer, 0);
 #else
@@ -227,45 +305,67 @@ void blink() {
     LED_OFF;
 }
 
+// remembers the access point we are connected to, only writes on change
+void wifiCacheStore() {
+    const uint8_t* bssid = WiFi.BSSID();
+    const uint8_t channel = WiFi.channel();
+    const uint32_t ip = (uint32_t) WiFi.localIP();
+
+    if (config.wifi_cache_flag == CFG_SET && memcmp(config.wifi_bssid, bssid, sizeof(config.wifi_bssid)) == 0 &&
+        config.wifi_channel == channel && config.wifi_ip == ip) return;
+
+    config.wifi_cache_flag = CFG_SET;
+    memcpy(config.wifi_bssid, bssid, sizeof(config.wifi_bssid));
+    config.wifi_channel = channel;
+    config.wifi_ip = ip;
+    config.wifi_gateway = (uint32_t) WiFi.gatewayIP();
+    config.wifi_subnet = (uint32_t) WiFi.subnetMask();
+    config.wifi_dns = (uint32_t) WiFi.dnsIP();
+
+    configStoreSave();
+
+    LOG_DEBUG(WIFI, "\nWi-Fi cache updated - channel %d\n", channel);
+}
+
 void wireConfig() {
-    // configuration storage
-    EEPROM.begin(EEPROM_SIZE);
-    EEPROM.get(0, config);
-    EEPROM.end();
+    // configuration storage, see config_store.h
+    configStoreLoad();
 
     if (config.hostname_flag != CFG_SET) {
         strcpy(config.hostname, DEFAULT_HOSTNAME);
     }
 
     if (config.ssid_flag == CFG_SET) {
-        if (String(config.ssid).length() > 0) wifimode = WIFI_STA;
+        if (config.ssid[0] != '\0') wifimode = WIFI_STA;
     } else {
         memset(config.ssid, CFG_NOT_SET, WIFI_SSID_LEN);
         wifimode = WIFI_AP;
     }
 
     if (config.ssid_pwd_flag != CFG_SET) memset(config.ssid_pwd, CFG_NOT_SET, WIFI_PASSWD_LEN);
+    if (config.ssid_flag != CFG_SET) config.wifi_cache_flag = CFG_NOT_SET;
 
     LOG_PRINTLN();
-    LOG_PRINTLN("        EEPROM size: [" + String(EEPROM_SIZE) + "]");
-    LOG_PRINTLN("        config size: [" + String(sizeof(config)) + "]\n");
-    LOG_PRINTLN("        config host: [" + String(config.hostname) + "] stored: " + (config.hostname_flag == CFG_SET ? "true" : "false"));
-    LOG_PRINTLN("        config ssid: [" + String(config.ssid) + "] stored: " + (config.ssid_flag == CFG_SET ? "true" : "false"));
-    LOG_PRINTLN("    config ssid pwd: [" + String(config.ssid_pwd) + "] stored: " + (config.ssid_pwd_flag == CFG_SET ? "true\n" : "false\n"));
+    LOG_PRINTF("     config journal: [%u] schema: %u\n", (unsigned int) config_journal_size, (unsigned int) config_schema);
+    LOG_PRINTF("        config size: [%u]\n\n", (unsigned int) sizeof(config));
+    LOG_PRINTF("        config host: [%s] stored: %s\n", config.hostname, config.hostname_flag == CFG_SET ? "true" : "false");
+    LOG_PRINTF("        config ssid: [%s] stored: %s\n", config.ssid, config.ssid_flag == CFG_SET ? "true" : "false");
+    LOG_PRINTF("    config ssid pwd: [%s] stored: %s\n\n", config.ssid_pwd, config.ssid_pwd_flag == CFG_SET ? "true" : "false");
 }
 
 void onOTAStart() {
     // Log when OTA has started
-    LOG_PRINTLN("\nOTA update started!");
+    LOG_INFO(OTA, "\nOTA update started!\n");
     // <Add your own code here>
 }
 
 void onOTAProgress(size_t current, size_t final) {
     // Log every 1 second
     if (millis() - ota_progress_millis > 1000) {
+        heartbeatSuspend();
         watchDogRefresh();
         ota_progress_millis = millis();
-        LOG_PRINTF("OTA Progress Current: %u bytes, Final: %u bytes\r", current, final);
+        LOG_INFO(OTA, "OTA Progress Current: %u bytes, Final: %u bytes\r", current, final);
         LOG_FLUSH();
     }
 }
@@ -273,53 +373,97 @@ void onOTAProgress(size_t current, size_t final) {
 void onOTAEnd(bool success) {
     // Log when OTA has finished
     if (success) {
-        LOG_PRINTLN("\nOTA update finished successfully!");
+        LOG_INFO(OTA, "\nOTA update finished successfully!\n");
+        crashlogNote(CRASH_OTA, "web");
         esp_reboot_requested = true;
     } else {
-        LOG_PRINTLN("\nThere was an error during OTA update!");
+        LOG_ERROR(OTA, "\nThere was an error during OTA update!\n");
     }
     LOG_FLUSH();
 }
 
-void updateHtmlTemplate(String template_filename, bool showTime = true) {
-
-    String output_filename = template_filename;
-    output_filename.replace(".template", "");
-
-    File _template = LittleFS.open(template_filename, FILE_READ);
-
-    if (_template) {
-        String html = _template.readString();
-        _template.close();
+const char* templateValue(const char* token, const char* timestamp) {
+    if (strcmp(token, "hostname") == 0) return config.hostname;
+    if (strcmp(token, "ssid") == 0) return config.ssid;
+    if (strcmp(token, "ssid_pwd") == 0) return config.ssid_pwd;
+    if (strcmp(token, "timestamp") == 0) return timestamp;
+    return NULL;
+}
 
-        while (html.indexOf("{hostname}", 0) != -1) {
-            html.replace("{hostname}", String(config.hostname));
-        }
+// streams the template into its output file, {hostname}, {ssid}, {ssid_pwd}
+// and {timestamp} are replaced on the way, any other braces pass through
+void updateHtmlTemplate(const char* template_filename, bool showTime = true) {
+    // "/setup.template.html" => "/setup.html"
+    const char* ext = strstr(template_filename, ".template");
+    if (ext == NULL) return;
 
-        while (html.indexOf("{ssid}", 0) != -1) {
-            html.replace("{ssid}", String(config.ssid));
-        }
+    char output_filename[32];
+    char new_filename[36];
+    snprintf(output_filename, sizeof(output_filename), "%.*s%s", (int) (ext - template_filename), template_filename, ext + strlen(".template"));
+    snprintf(new_filename, sizeof(new_filename), "%s.new", output_filename);
 
-        while (html.indexOf("{ssid_pwd}", 0) != -1) {
-            html.replace("{ssid_pwd}", String(config.ssid_pwd));
-        }
+    File _template = LittleFS.open(template_filename, FILE_READ);
+    if (!_template) return;
+
+    char timestamp[TIME_TEXT_LEN];
+    timeFormat(timeNowUs(), timestamp, sizeof(timestamp));
+    if (showTime) LOG_PRINTF("Timestamp   = %s\n", timestamp);
+
+    File _index = LittleFS.open(new_filename, FILE_WRITE);
+    LOG_LINE out;
+    logLineBegin(&out, _index);
+
+    char chunk[64];
+    char token[16];
+    int token_len = -1;     // -1 => outside of a {token}
+    int n;
+
+    while ((n = _template.read((uint8_t*) chunk, sizeof(chunk))) > 0) {
+        for (int i = 0; i < n; i++) {
+            const char c = chunk[i];
+
+            if (token_len >= 0) {
+                if (c == '}') {
+                    token[token_len] = '\0';
+                    const char* value = templateValue(token, timestamp);
+                    if (value != NULL) {
+                        logStr(&out, value);
+                    } else {
+                        logChar(&out, '{');
+                        logBytes(&out, token, token_len);
+                        logChar(&out, '}');
+                    }
+                    token_len = -1;
+                    continue;
+                }
+                if ((isalnum(c) || c == '_') && token_len < (int) sizeof(token) - 1) {
+                    token[token_len++] = c;
+                    continue;
+                }
+                // not a token (css, javascript), give back what was held
+                logChar(&out, '{');
+                logBytes(&out, token, token_len);
+                token_len = -1;
+            }
 
-        if (html.indexOf("{timestamp}", 0) != 1) {
-            String timestamp = getTimestamp();
-            while (html.indexOf("{timestamp}", 0) != -1) {
-                html.replace("{timestamp}", timestamp);
+            if (c == '{') {
+                token_len = 0;
+            } else {
+                logChar(&out, c);
             }
-            if (showTime)
-                LOG_PRINTLN("Timestamp   = " + timestamp);
         }
+    }
+    if (token_len >= 0) {
+        logChar(&out, '{');
+        logBytes(&out, token, token_len);
+    }
 
-        File _index = LittleFS.open(output_filename + ".new", FILE_WRITE);
-        _index.print(html.c_str());
-        _index.close();
+    logFlush(&out);
+    _index.close();
+    _template.close();
 
-        LittleFS.remove(output_filename);
-        LittleFS.rename(output_filename + ".new", output_filename);
-    }
+    LittleFS.remove(output_filename);
+    LittleFS.rename(new_filename, output_filename);
 }
 
 void wireArduinoOTA(const char* hostname) {
@@ -327,38 +471,40 @@ void wireArduinoOTA(const char* hostname) {
 
     ArduinoOTA.onStart([]()
         {
-            String type;
-            if (ArduinoOTA.getCommand() == U_FLASH)
-                type = "sketch";
-            else // U_SPIFFS
-                type = "filesystem";
+            // U_SPIFFS otherwise
+            const char* type = ArduinoOTA.getCommand() == U_FLASH ? "sketch" : "filesystem";
 
             // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
-            LOG_PRINTLN("\nOTA triggered for updating " + type);
+            LOG_INFO(OTA, "\nOTA triggered for updating %s\n", type);
         });
 
     ArduinoOTA.onEnd([]()
         {
-            LOG_PRINTLN("\nOTA End");
+            LOG_INFO(OTA, "\nOTA End\n");
             LOG_FLUSH();
+            crashlogNote(CRASH_OTA, "arduino");
+            // ArduinoOTA restarts on its own right after this, coreLoop never sees the request
+            crashlogPersist();
             esp_reboot_requested = true;
         });
 
     ArduinoOTA.onProgress([](unsigned int progress, unsigned int total)
         {
+            // the upload blocks the loop, keep the watchdog fed while data arrives
+            heartbeatSuspend();
             watchDogRefresh();
-            LOG_PRINTF("Progress: %u%%\r", (progress / (total / 100)));
+            LOG_INFO(OTA, "Progress: %u%%\r", (progress / (total / 100)));
             LOG_FLUSH();
         });
 
     ArduinoOTA.onError([](ota_error_t error)
         {
-            LOG_PRINTF("\nError[%u]: ", error);
-            if (error == OTA_AUTH_ERROR) LOG_PRINTLN("Auth Failed");
-            else if (error == OTA_BEGIN_ERROR) LOG_PRINTLN("Begin Failed");
-            else if (error == OTA_CONNECT_ERROR) LOG_PRINTLN("Connect Failed");
-            else if (error == OTA_RECEIVE_ERROR) LOG_PRINTLN("Receive Failed");
-            else if (error == OTA_END_ERROR) LOG_PRINTLN("End Failed");
+            LOG_ERROR(OTA, "\nError[%u]: %s\n", error,
+                error == OTA_AUTH_ERROR ? "Auth Failed" :
+                error == OTA_BEGIN_ERROR ? "Begin Failed" :
+                error == OTA_CONNECT_ERROR ? "Connect Failed" :
+                error == OTA_RECEIVE_ERROR ? "Receive Failed" :
+                error == OTA_END_ERROR ? "End Failed" : "");
             LOG_FLUSH();
         });
 
@@ -367,101 +513,25 @@ void wireArduinoOTA(const char* hostname) {
 }
 
 void wireWebServerAndPaths() {
-    // define default document
-    server.on("/", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->redirect("/index.html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
+    // static pages and captive portal probes
+    wireRoutes();
 
-    // define setup document
-    server.on("/setup", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            request->send(LittleFS, "/setup.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
+    // IR learn / send REST api
+    wireIrApi();
 
-    // captive portal
-    server.on("/hotspot-detect.html", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->send(LittleFS, "/index.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-    server.on("/library/test/success.html", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->send(LittleFS, "/index.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-    server.on("/generate_204", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->send(LittleFS, "/index.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-    server.on("/gen_204", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->send(LittleFS, "/index.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-    server.on("/ncsi.txt", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->send(LittleFS, "/index.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-    server.on("/check_network_status.txt", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            ap_mode_activity = true;
-            request->send(LittleFS, "/index.html", "text/html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-
-    // request reboot
-    server.on("/reboot", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            request->redirect("/index.html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-            esp_reboot_requested = true;
-        });
-
-    // save config
-    server.on("/save", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            saveConfig(request->getParam("hostname")->value(),
-            request->getParam("ssid")->value(),
-            request->getParam("ssid_pwd")->value());
-
-    request->redirect("/index.html");
-    LOG_PRINTLN("\n" + request->url() + " handled");
-        });
-
-    // load config
-    server.on("/load", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            LOG_PRINTLN();
-            wireConfig();
-            setup_needs_update = true;
-            request->redirect("/index.html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
-        });
+    // live capture push
+    wireIrPush();
 
-    // wipe config
-    server.on("/wipe", HTTP_GET, [](AsyncWebServerRequest* request)
-        {
-            const boolean reboot = !request->hasParam("noreboot");
-
-            wipeConfig();
+    // bulk export / import
+    wireArchive();
 
-            request->redirect("/index.html");
-            LOG_PRINTLN("\n" + request->url() + " handled");
+    // previous boot's log
+    wireCrashLog();
 
-            // trigger a reboot
-            if (reboot) esp_reboot_requested = true;
-        });
+#ifdef PROFILER
+    // loop trace
+    wireProfiler();
+#endif
 
     // 404 (includes file handling)
     server.onNotFound([](AsyncWebServerRequest* request)
@@ -470,18 +540,20 @@ void wireWebServerAndPaths() {
 
             if (LittleFS.exists(request->url())) {
                 AsyncWebServerResponse* response = request->beginResponse(LittleFS, request->url(), String());
-                String url = request->url(); url.toLowerCase();
                 // only chache digital assets
-                if (url.indexOf(".png") != -1 || url.indexOf(".jpg") != -1 || url.indexOf(".ico") != -1 || url.indexOf(".svg") != -1) {
+                const char* ext = strrchr(request->url().c_str(), '.');
+                if (ext != NULL && (strcasecmp(ext, ".png") == 0 || strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".ico") == 0 || strcasecmp(ext, ".svg") == 0)) {
                     response->addHeader("Cache-Control", "max-age=604800");
                 } else {
                     response->addHeader("Cache-Control", "no-store");
                 }
                 request->send(response);
-                LOG_PRINTLN("\n" + request->url() + " handled");
+                LOG_DEBUG(HTTP, "\n%s handled\n", request->url().c_str());
             } else {
-                request->send(404, "text/plain", request->url() + " Not found!");
-                LOG_PRINTLN("\n" + request->url() + " Not found!");
+                char message[128];
+                snprintf(message, sizeof(message), "%s Not found!", request->url().c_str());
+                request->send(404, "text/plain", message);
+                LOG_WARN(HTTP, "\n%s Not found!\n", request->url().c_str());
             }
         });
 
@@ -490,39 +562,39 @@ void wireWebServerAndPaths() {
     LOG_PRINTLN("HTTP server started");
 }
 
-void saveConfig(String hostname,
-                String ssid,
-                String ssid_pwd) {
+void saveConfig(const char* hostname,
+                const char* ssid,
+                const char* ssid_pwd) {
 
     memset(config.hostname, CFG_NOT_SET, HOSTNAME_LEN);
-    if (hostname.length() > 0) {
+    if (hostname[0] != '\0') {
         config.hostname_flag = CFG_SET;
     } else {
         config.hostname_flag = CFG_NOT_SET;
         hostname = DEFAULT_HOSTNAME;
     }
-    hostname.toCharArray(config.hostname, HOSTNAME_LEN);
+    strncpy(config.hostname, hostname, HOSTNAME_LEN - 1);
 
     memset(config.ssid, CFG_NOT_SET, WIFI_SSID_LEN);
-    if (ssid.length() > 0) {
-        ssid.toCharArray(config.ssid, WIFI_SSID_LEN);
+    if (ssid[0] != '\0') {
+        strncpy(config.ssid, ssid, WIFI_SSID_LEN - 1);
         config.ssid_flag = CFG_SET;
     } else {
         config.ssid_flag = CFG_NOT_SET;
     }
 
     memset(config.ssid_pwd, CFG_NOT_SET, WIFI_PASSWD_LEN);
-    if (ssid_pwd.length() > 0) {
-        ssid_pwd.toCharArray(config.ssid_pwd, WIFI_PASSWD_LEN);
+    if (ssid_pwd[0] != '\0') {
+        strncpy(config.ssid_pwd, ssid_pwd, WIFI_PASSWD_LEN - 1);
         config.ssid_pwd_flag = CFG_SET;
     } else {
         config.ssid_pwd_flag = CFG_NOT_SET;
     }
 
-    EEPROM.begin(EEPROM_SIZE);
-    EEPROM.put(0, config);
-    EEPROM.commit();
-    EEPROM.end();
+    // new credentials may mean another network, scan on the next boot
+    config.wifi_cache_flag = CFG_NOT_SET;
+
+    configStoreSave();
 
     setup_needs_update = true;
 }
@@ -534,11 +606,9 @@ void wipeConfig() {
     memset(config.ssid, CFG_NOT_SET, WIFI_SSID_LEN);
     config.ssid_pwd_flag = CFG_NOT_SET;
     memset(config.ssid_pwd, CFG_NOT_SET, WIFI_PASSWD_LEN);
+    config.wifi_cache_flag = CFG_NOT_SET;
 
-    EEPROM.begin(EEPROM_SIZE);
-    EEPROM.put(0, config);
-    EEPROM.commit();
-    EEPROM.end();
+    configStoreSave();
 
     LOG_PRINTLN("\nConfig wiped");
 }
@@ -547,191 +617,180 @@ bool isSampleValid(float value) {
     return value < SHRT_MAX && value > SHRT_MIN;
 }
 
-String toFloatStr(float value, short decimal_places) {
-    char buf[20];
-    String fmt;
-
-    fmt = "%." + String(decimal_places) + "f";
-    sprintf(buf, fmt.c_str(), value);
+// /last_signal.txt holds at most one capture buffer, plus the '\0'
+uint16_t tx_raw[CAPTURE_BUFFER_SIZE / 2 + 1];
+
+void cmdTransmit(int argc, char** argv) {
+    File file = LittleFS.open("/last_signal.txt", FILE_READ);
+
+    if (file.size() > 0) {
+        const int n = file.read((uint8_t*) tx_raw, sizeof(tx_raw) - sizeof(uint16_t));
+        file.close();
+        if (n <= 0) return;
+        ((char*) tx_raw)[n] = '\0';
+
+        irrecv.pause();
+        irsend.sendRaw(tx_raw, n / sizeof(uint16_t), 38);  // Send a raw data capture at 38kHz.
+        irrecv.resume();
+
+        // appended, a long capture would not fit one formatted line
+        LOG_LINE line;
+        logLineBegin(&line);
+        logStr(&line, "IRsend: [");
+        logStr(&line, (char*) tx_raw);
+        logStr(&line, "]\n");
+        logFlush(&line);
+    } else {
+        CONSOLE_PRINTLN("Nothing to transmit");
+    }
 
-    return String(buf);
+    file.close();
 }
 
-#ifdef ENABLE_DEBUG
-void checkForRemoteCommand() {
-    if (SerialAndTelnet.available() > 0) {
-        char c = SerialAndTelnet.read();
-        switch (c) {
-        case '\r':
-            LOG_PRINT("\r");
-            break;
-        case '\n':
-            LOG_PRINT("\n");
-            break;
-        case 'D':
-            LOG_PRINTLN("\nDisconnecting Wi-Fi. . .");
-            LOG_FLUSH();
-            WiFi.disconnect();
-            break;
-        case 'F':
-        {
-#ifdef esp32
-            const size_t fs_size = LittleFS.totalBytes() / 1000;
-            const size_t fs_used = LittleFS.usedBytes() / 1000;
-#else
-            FSInfo fs_info;
-            LittleFS.info(fs_info);
-            const size_t fs_size = fs_info.totalBytes / 1000;
-            const size_t fs_used = fs_info.usedBytes / 1000;
-#endif
-            LOG_PRINTLN("\n    Filesystem size: [" + String(fs_size) + "] KB");
-            LOG_PRINTLN("         Free space: [" + String(fs_size - fs_used) + "] KB\n");
-        }
-        break;
-        case 'S':
-        {
-            LOG_PRINTLN("\nType SSID and press <ENTER>");
-            LOG_FLUSH();
+void cmdHistory(int argc, char** argv) {
+    File file = LittleFS.open("/signals.txt", FILE_READ);
+
+    if (file.size() > 0) {
+        // streamed, the history can be larger than the free heap
+        uint8_t chunk[64];
+        int n;
+        CONSOLE_PRINTLN("\nSignal History\n");
+        while ((n = file.read(chunk, sizeof(chunk))) > 0) SerialAndTelnet.write(chunk, n);
+        CONSOLE_PRINTLN();
+        CONSOLE_PRINTLN();
+    } else {
+        CONSOLE_PRINTLN("No signal history available");
+    }
 
-            String ssid;
-            do {
-                if (SerialAndTelnet.available() > 0) {
-                    c = SerialAndTelnet.read();
-                    if (c != 10 && c != 13) {
-                        LOG_PRINT(c);
-                        LOG_FLUSH();
-                        ssid = ssid + String(c);
-                    }
-                }
-                watchDogRefresh();
-            } while (c != 13);
+    file.close();
+}
 
-            LOG_PRINTLN("\nType PASSWORD and press <ENTER>");
-            LOG_FLUSH();
-            String ssid_pwd;
-            do {
-                if (SerialAndTelnet.available() > 0) {
-                    c = SerialAndTelnet.read();
-                    if (c != 10 && c != 13) {
-                        LOG_PRINT(c);
-                        LOG_FLUSH();
-                        ssid_pwd = ssid_pwd + String(c);
-                    }
-                }
-                watchDogRefresh();
-            } while (c != 13);
+void cmdTime(int argc, char** argv) {
+    char timestamp[TIME_TEXT_LEN];
+    CONSOLE_PRINTF("Current timestamp: [%s]%s\n", timeFormat(timeNowUs(), timestamp, sizeof(timestamp)),
+        time_synced ? "" : " - uptime, NTP not synced");
+}
 
-            LOG_PRINTLN("\n\nSSID=[" + ssid + "] PWD=[" + ssid_pwd + "]\n");
-            LOG_FLUSH();
+void cmdLogLevel(int argc, char** argv) {
+    static const char* const levels[] = { "none", "error", "warn", "info", "debug", "trace" };
 
-            memset(config.ssid, CFG_NOT_SET, WIFI_SSID_LEN);
-            if (ssid.length() > 0) {
-                ssid.toCharArray(config.ssid, WIFI_SSID_LEN);
-                config.ssid_flag = CFG_SET;
-            } else {
-                config.ssid_flag = CFG_NOT_SET;
-            }
+    if (argc > 1) {
+        tiny_int i = 0;
+        while (i <= LOG_LEVEL_TRACE && strcasecmp(argv[1], levels[i]) != 0) i++;
+        if (i > LOG_LEVEL_TRACE) {
+            CONSOLE_PRINTLN("\nusage: level [none|error|warn|info|debug|trace]");
+            return;
+        }
+        log_level = i;
+    } else {
+        log_level = log_level >= LOG_LEVEL_TRACE ? LOG_LEVEL_ERROR : log_level + 1;
+    }
+    CONSOLE_PRINTF("\nLog level: %s\n", levels[log_level]);
+}
 
-            memset(config.ssid_pwd, CFG_NOT_SET, WIFI_PASSWD_LEN);
-            if (ssid_pwd.length() > 0) {
-                ssid_pwd.toCharArray(config.ssid_pwd, WIFI_PASSWD_LEN);
-                config.ssid_pwd_flag = CFG_SET;
-            } else {
-                config.ssid_pwd_flag = CFG_NOT_SET;
-            }
+#ifdef LOG_BINARY
+void cmdBinaryLog(int argc, char** argv) {
+    binlog_enabled = !binlog_enabled;
+    CONSOLE_PRINTLN(binlog_enabled ? "\nBinary log enabled" : "\nBinary log disabled");
+}
+#endif
 
-            EEPROM.begin(EEPROM_SIZE);
-            EEPROM.put(0, config);
-            EEPROM.commit();
-            EEPROM.end();
+void cmdTelnetStats(int argc, char** argv) {
+    CONSOLE_PRINTF("\nTelnet: %u clients, %u packets/KB, echo %u ms (max %u ms), dropped %u bytes / %u lines\n",
+        SerialAndTelnet.getClientCount(), SerialAndTelnet.getPacketsPerKB(), SerialAndTelnet.getEchoLatency(),
+        SerialAndTelnet.getEchoLatencyMax(), (unsigned int) SerialAndTelnet.getDroppedBytes(), (unsigned int) SerialAndTelnet.getDroppedLines());
+}
 
-            LOG_PRINTLN("SSID and Password saved - reload config or reboot\n");
-            LOG_FLUSH();
-        }
-        break;
-        case 'L':
-            wireConfig();
-            setup_needs_update = true;
-            break;
-        case 'W':
-            wipeConfig();
-            break;
-        case 'X':
-            LOG_PRINTLN(F("\r\nClosing session..."));
-            SerialAndTelnet.disconnectClient();
-            break;
-        case 'R':
-            LOG_PRINTLN(F("\r\nsubmitting reboot request..."));
-            esp_reboot_requested = true;
-            break;
-        case ' ':
-            // do nothing -- just a simple echo
-            break;
-        case 'C':
-            // current time
-            LOG_PRINTF("Current timestamp: [%s]\n", getTimestamp().c_str());
-            break;
-        case 'T':
-        {
-            File file = LittleFS.open("/last_signal.txt", FILE_READ);
+void cmdDisconnect(int argc, char** argv) {
+    CONSOLE_PRINTLN("\nDisconnecting Wi-Fi. . .");
+    LOG_FLUSH();
+    WiFi.disconnect();
+}
 
-            if (file.size() > 0) {
-                String rawString = file.readString();
-                file.close();
+void cmdFilesystem(int argc, char** argv) {
+#ifdef esp32
+    const size_t fs_size = LittleFS.totalBytes() / 1000;
+    const size_t fs_used = LittleFS.usedBytes() / 1000;
+#else
+    FSInfo fs_info;
+    LittleFS.info(fs_info);
+    const size_t fs_size = fs_info.totalBytes / 1000;
+    const size_t fs_used = fs_info.usedBytes / 1000;
+#endif
+    CONSOLE_PRINTF("\n    Filesystem size: [%u] KB\n", (unsigned int) fs_size);
+    CONSOLE_PRINTF("         Free space: [%u] KB\n\n", (unsigned int) (fs_size - fs_used));
+}
 
-                irrecv.pause();
-                irsend.sendRaw((uint16_t*)rawString.c_str(), rawString.length(), 38);  // Send a raw data capture at 38kHz.
-                irrecv.resume();
+char console_ssid[WIFI_SSID_LEN];
 
-                LOG_PRINTF("IRsend: [%s]\n", rawString.c_str());
-            } else {
-                LOG_PRINTLN("Nothing to transmit");
-            }
+void saveWifi(const char* ssid, const char* ssid_pwd) {
+    CONSOLE_PRINTF("\n\nSSID=[%s] PWD=[%s]\n\n", ssid, ssid_pwd);
+    saveConfig(config.hostname_flag == CFG_SET ? config.hostname : "", ssid, ssid_pwd);
+    CONSOLE_PRINTLN("SSID and Password saved - reload config or reboot\n");
+}
 
-            file.close();
-        }
-        break;
-        case 'H':
-        {
-            File file = LittleFS.open("/signals.txt", FILE_READ);
+void onPasswordEntered(char* line) {
+    saveWifi(console_ssid, line);
+}
 
-            if (file.size() > 0) {
-                String history = file.readString();
-                LOG_PRINTLN("\nSignal History\n");
-                LOG_PRINTLN(history);
-                LOG_PRINTLN();
-            } else {
-                LOG_PRINTLN("No signal history available");
-            }
+void onSsidEntered(char* line) {
+    strncpy(console_ssid, line, WIFI_SSID_LEN - 1);
+    console_ssid[WIFI_SSID_LEN - 1] = '\0';
+    shellPrompt("Type PASSWORD and press <ENTER>", onPasswordEntered, true);
+}
 
-            file.close();
-        }
-        break;
-        default:
-            LOG_PRINT("\n\nCommands:\n\nT = Transmit Received Code\nH = Received History\nC = Current Timestamp\nD = Disconnect WiFi\nF = Filesystem Info\nS - Set SSID / Password\nL = Reload Config\nW = Wipe Config\nX = Close Session\nR = Reboot ESP\n\n");
-            break;
-        }
-        SerialAndTelnet.flush();
+void cmdWifi(int argc, char** argv) {
+    if (argc > 1) {
+        saveWifi(argv[1], argc > 2 ? argv[2] : "");
+    } else {
+        // the answers arrive on later loop passes
+        shellPrompt("Type SSID and press <ENTER>", onSsidEntered);
     }
 }
-#endif
 
-String getTimestamp() {
-    struct tm timeinfo;
-    char timebuf[255];
+void cmdReload(int argc, char** argv) {
+    wireConfig();
+    setup_needs_update = true;
+}
 
-    if (wifimode == WIFI_AP || !getLocalTime(&timeinfo)) {
-        const unsigned long now = millis();
-        sprintf(timebuf, "%06lu.%03lu", now / 1000, now % 1000);
-    } else {
-        sprintf(timebuf, "%4d-%2.2d-%2.2d %2.2d:%2.2d:%2.2d", timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
-    }
+void cmdWipe(int argc, char** argv) {
+    wipeConfig();
+}
+
+void cmdExit(int argc, char** argv) {
+    CONSOLE_PRINTLN(F("\r\nClosing session..."));
+    SerialAndTelnet.disconnectClient();
+}
 
-    return String(timebuf);
+void cmdReboot(int argc, char** argv) {
+    CONSOLE_PRINTLN(F("\r\nsubmitting reboot request..."));
+    crashlogNote(CRASH_REQUESTED, "console");
+    esp_reboot_requested = true;
 }
 
-boolean isNumeric(String str) {
-    unsigned int stringLength = str.length();
+void wireConsole() {
+    wireShell();
+
+    shellRegister("tx", "Transmit Received Code", cmdTransmit);
+    shellRegister("history", "Received History", cmdHistory);
+    shellRegister("time", "Current Timestamp", cmdTime);
+    shellRegister("level", "Set / Cycle Log Level [none|error|warn|info|debug|trace]", cmdLogLevel);
+#ifdef LOG_BINARY
+    shellRegister("binlog", "Toggle Binary Log", cmdBinaryLog);
+#endif
+    shellRegister("telnet", "Telnet Stats", cmdTelnetStats);
+    shellRegister("disconnect", "Disconnect WiFi", cmdDisconnect);
+    shellRegister("fs", "Filesystem Info", cmdFilesystem);
+    shellRegister("heap", "Heap Stats / Soak Test [soak [hours]]", cmdHeap);
+    shellRegister("wifi", "Set SSID / Password [ssid [password]]", cmdWifi);
+    shellRegister("reload", "Reload Config", cmdReload);
+    shellRegister("wipe", "Wipe Config", cmdWipe);
+    shellRegister("exit", "Close Session", cmdExit);
+    shellRegister("reboot", "Reboot ESP", cmdReboot);
+}
+
+boolean isNumeric(const char* str) {
+    unsigned int stringLength = strlen(str);
 
     if (stringLength == 0) {
         return false;
@@ -740,11 +799,11 @@ boolean isNumeric(String str) {
     boolean seenDecimal = false;
 
     for (unsigned int i = 0; i < stringLength; ++i) {
-        if (isDigit(str.charAt(i))) {
+        if (isDigit(str[i])) {
             continue;
         }
 
-        if (str.charAt(i) == '.') {
+        if (str[i] == '.') {
             if (seenDecimal) {
                 return false;
             }
@@ -756,25 +815,125 @@ boolean isNumeric(String str) {
     return true;
 }
 
+uint32_t heapMaxBlock() {
+#ifdef esp32
+    return ESP.getMaxAllocHeap();
+#else
+    return ESP.getMaxFreeBlockSize();
+#endif
+}
+
 void printHeapStats() {
-#ifdef ENABLE_DEBUG
+#ifdef esp32
+    CONSOLE_PRINTF("\n(%lu) -> size: %5u - free: %5u - max: %5u - min: %5u <-\n", millis(),
+        (unsigned int) ESP.getHeapSize(), (unsigned int) ESP.getFreeHeap(), (unsigned int) heapMaxBlock(), (unsigned int) ESP.getMinFreeHeap());
+#else
     uint32_t myfree;
     uint32_t mymax;
     uint8_t myfrag;
-
-#ifdef esp32 
-    const uint32_t size = ESP.getHeapSize();
-    const uint32_t free = ESP.getFreeHeap();
-    const uint32_t max = ESP.getMaxAllocHeap();
-    const uint32_t min = ESP.getMinFreeHeap();
-    LOG_PRINTF("\n(%ld) -> size: %5d - free: %5d - max: %5d - min: %5d <-\n", millis(), size, free, max, min);
-#else
     ESP.getHeapStats(&myfree, &mymax, &myfrag);
-    LOG_PRINTF("\n(%ld) -> free: %5d - max: %5d - frag: %3d%% <-\n", millis(), myfree, mymax, myfrag);
-#endif
+    CONSOLE_PRINTF("\n(%lu) -> free: %5u - max: %5u - frag: %3u%% <-\n", millis(), (unsigned int) myfree, (unsigned int) mymax, (unsigned int) myfrag);
 #endif
+    CONSOLE_PRINTF("truncated log lines: %u\n", (unsigned int) log_truncated);
+}
 
-    return;
+// heap soak
+//
+// pushes a simulated day of log traffic, one line a second, through the
+// real LOG_* / CONSOLE_PRINTF / LOG_LINE call paths into SerialAndTelnet,
+// so the TelnetSpy ring and the crash log tap see every byte, and reports
+// the largest free block after every simulated hour. runs as a scheduler
+// task inside its budget; the serial port paces it, a simulated day takes
+// about ten minutes at 115200. LOG_WARN lines are skipped below that
+// log level, the other two paths always print.
+
+#define HEAP_SOAK_LINES_PER_HOUR    3600
+#define HEAP_SOAK_SLACK             256     // other tasks allocate meanwhile
+
+typedef struct heap_soak {
+    uint16_t hours;             // 0 => not running
+    uint32_t lines;             // left to format
+    uint32_t start_block;
+    uint32_t min_block;
+    uint32_t min_free;
+} HEAP_SOAK;
+
+HEAP_SOAK heap_soak;
+
+// one line through one of the output paths, taking turns
+void heapSoakLine(uint32_t n) {
+    char ts[TIME_TEXT_LEN];
+    timeFormat(timeNowUs(), ts, sizeof(ts));
+
+    switch (n % 3) {
+    case 0:
+        // binary records when built with LOG_BINARY
+        LOG_WARN(CORE, "soak %s heartbeat: %s stalled for %lu ms\n", ts, heartbeat_names[n % HEARTBEATS], (unsigned long) n);
+        break;
+    case 1:
+    {
+        const IPAddress ip = WiFi.localIP();
+        CONSOLE_PRINTF("soak %s host: [%s] ip: " LOG_IP_FMT " free: %u\n", ts, config.hostname, LOG_IP_ARGS(ip), (unsigned int) ESP.getFreeHeap());
+    }
+    break;
+    default:
+    {
+        LOG_LINE line;
+        logLineBegin(&line);
+        logStr(&line, "soak ");
+        logStr(&line, ts);
+        logStr(&line, " stored: ");
+        logBool(&line, config.hostname_flag == CFG_SET);
+        logStr(&line, " cached ip: ");
+        logIp(&line, config.wifi_ip);
+        logStr(&line, " seq: 0x");
+        logHex(&line, n, 8);
+        logChar(&line, '\n');
+        logFlush(&line);
+    }
+    break;
+    }
+}
+
+bool heapSoakStep() {
+    if (heap_soak.hours == 0) return false;
+
+    while (heap_soak.lines > 0 && schedulerBudgetLeft()) {
+        heapSoakLine(heap_soak.lines--);
+        if (heap_soak.lines % HEAP_SOAK_LINES_PER_HOUR != 0) continue;
+
+        const uint32_t block = heapMaxBlock();
+        const uint32_t free = ESP.getFreeHeap();
+        if (block < heap_soak.min_block) heap_soak.min_block = block;
+        if (free < heap_soak.min_free) heap_soak.min_free = free;
+        CONSOLE_PRINTF("soak: hour %2u - free: %5u - max block: %5u\n",
+            (unsigned int) (heap_soak.hours - heap_soak.lines / HEAP_SOAK_LINES_PER_HOUR), (unsigned int) free, (unsigned int) block);
+    }
+    if (heap_soak.lines > 0) return true;
+
+    const bool stable = heap_soak.min_block + HEAP_SOAK_SLACK >= heap_soak.start_block;
+    CONSOLE_PRINTF("\nsoak: %u simulated hours - max block %u at start, %u lowest, min free %u -- %s\n",
+        (unsigned int) heap_soak.hours, (unsigned int) heap_soak.start_block, (unsigned int) heap_soak.min_block,
+        (unsigned int) heap_soak.min_free, stable ? "stable" : "SHRINKING");
+    heap_soak.hours = 0;
+    return false;
+}
+
+void cmdHeap(int argc, char** argv) {
+    if (argc > 1 && strcasecmp(argv[1], "soak") == 0) {
+        if (heap_soak.hours > 0) {
+            CONSOLE_PRINTLN("\nSoak already running");
+            return;
+        }
+        const long hours = argc > 2 ? atol(argv[2]) : 24;
+        heap_soak.hours = hours > 0 && hours < 1000 ? hours : 24;
+        heap_soak.lines = (uint32_t) heap_soak.hours * HEAP_SOAK_LINES_PER_HOUR;
+        heap_soak.start_block = heap_soak.min_block = heapMaxBlock();
+        heap_soak.min_free = ESP.getFreeHeap();
+        CONSOLE_PRINTF("\nsoak: %u simulated hours, max block %u\n", (unsigned int) heap_soak.hours, (unsigned int) heap_soak.start_block);
+        return;
+    }
+    printHeapStats();
 }
 
 #ifdef DECODE_AC
@@ -831,6 +990,9 @@ void dumpACInfo(decode_results* results) {
     }
 #endif  // DECODE_HAIER_AC
     // If we got a human-readable description of the message, display it.
-    if (description != "")  Serial.println("Mesg Desc.: " + description);
+    if (description != "") {
+        Serial.print("Mesg Desc.: ");
+        Serial.println(description);
+    }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// loop profiler
+//
+// build with -D PROFILER to record spans. PROFILE_SPAN(name) times the rest
+// of the enclosing block with the cpu cycle counter and stores name, start
+// and duration in a fixed RAM ring, the youngest PROFILER_SPANS survive.
+// every scheduler task is a span, the capture path adds its own.
+//
+// the ring is dumped as Chrome trace-event JSON by the trace console command
+// and GET /api/trace, load it into chrome://tracing or ui.perfetto.dev. both
+// format one event at a time on the stack; the web dump is a chunked
+// response that walks the ring with a cursor, so no copy of the JSON is held.
+// without PROFILER the macro is empty and nothing is compiled in.
+
+#ifdef PROFILER
+
+#ifndef PROFILER_SPANS
+#define PROFILER_SPANS          256
+#endif
+#define PROFILER_PART_LEN       128         // one trace event, span names are short literals
+#define PROFILER_PAUSE_MAX_MS   10000
+
+typedef struct profiler_span {
+    const char* name;           // must be a literal or otherwise live forever
+    uint32_t start_us;
+    uint32_t cycles;
+} PROFILER_SPAN;
+
+PROFILER_SPAN profiler_ring[PROFILER_SPANS];
+uint16_t profiler_head = 0;
+bool profiler_wrapped = false;
+bool profiler_paused = false;
+uint32_t profiler_pause_ms = 0;
+
+void profilerRecord(const char* name, uint32_t start_us, uint32_t cycles) {
+    if (profiler_paused) {
+        // a dump whose client went away never resumes, give up after a while
+        if (millis() - profiler_pause_ms < PROFILER_PAUSE_MAX_MS) return;
+        profiler_paused = false;
+    }
+
+    profiler_ring[profiler_head] = { name, start_us, cycles };
+    if (++profiler_head >= PROFILER_SPANS) {
+        profiler_head = 0;
+        profiler_wrapped = true;
+    }
+}
+
+class ProfilerScope {
+public:
+    ProfilerScope(const char* name) : name(name), start_us(micros()), start_cycles(ESP.getCycleCount()) {}
+    ~ProfilerScope() { profilerRecord(name, start_us, ESP.getCycleCount() - start_cycles); }
+
+private:
+    const char* name;
+    uint32_t start_us;
+    uint32_t start_cycles;
+};
+
+#define PROFILE_SPAN(name)      ProfilerScope profiler_scope_(name)
+
+// recording pauses while a dump runs, so the cursor walks a stable ring
+uint16_t profilerPause() {
+    profiler_paused = true;
+    profiler_pause_ms = millis();
+    return profiler_wrapped ? PROFILER_SPANS : profiler_head;
+}
+
+// part -1 is the JSON head, 0 .. count - 1 the spans oldest first, count the tail.
+// snprintf semantics: returns the full length even if it did not fit
+int profilerJsonPart(char* buf, size_t len, int32_t part, uint16_t count) {
+    if (part < 0) return snprintf(buf, len, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    if (part >= count) return snprintf(buf, len, "\n]}\n");
+
+    const uint16_t first = profiler_wrapped ? profiler_head : 0;
+    const PROFILER_SPAN* span = &profiler_ring[(first + part) % PROFILER_SPANS];
+    const uint32_t dur_ns = (uint32_t) ((uint64_t) span->cycles * 1000 / ESP.getCpuFreqMHz());
+    return snprintf(buf, len, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lu,\"dur\":%lu.%03lu}",
+        part ? "," : "", span->name, (unsigned long) span->start_us,
+        (unsigned long) (dur_ns / 1000), (unsigned long) (dur_ns % 1000));
+}
+
+void profilerDump(Print& out) {
+    const uint16_t count = profilerPause();
+    char part[PROFILER_PART_LEN];
+
+    for (int32_t i = -1; i <= count; i++) {
+        const int n = profilerJsonPart(part, sizeof(part), i, count);
+        if (n > 0) out.write((const uint8_t*) part, min((size_t) n, sizeof(part) - 1));
+    }
+
+    profiler_paused = false;
+}
+
+void profilerClear() {
+    profiler_head = 0;
+    profiler_wrapped = false;
+}
+
+void cmdTrace(int argc, char** argv) {
+    if (argc > 1 && strcasecmp(argv[1], "clear") == 0) {
+        profilerClear();
+        CONSOLE_PRINTLN("\nTrace cleared");
+        return;
+    }
+    CONSOLE_PRINTLN();
+    profilerDump(SerialAndTelnet);
+}
+
+void wireProfiler() {
+    server.on("/api/trace", HTTP_GET, [](AsyncWebServerRequest* request)
+        {
+            const uint16_t count = profilerPause();
+            int32_t next = -1;
+
+            // every chunk is filled with whole parts straight from the ring
+            AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+                [count, next](uint8_t* buffer, size_t maxLen, size_t index) mutable -> size_t
+                {
+                    char* out = (char*) buffer;
+                    size_t used = 0;
+
+                    while (next <= count) {
+                        const int n = profilerJsonPart(out + used, maxLen - used, next, count);
+                        if (n < 0 || used + n >= maxLen) break;
+                        used += n;
+                        next++;
+                    }
+                    if (next > count) profiler_paused = false;
+
+                    if (used == 0 && next <= count) return RESPONSE_TRY_AGAIN;
+                    return used;
+                });
+            response->addHeader("Cache-Control", "no-store");
+            request->send(response);
+        });
+    server.on("/api/trace", HTTP_DELETE, [](AsyncWebServerRequest* request)
+        {
+            profilerClear();
+            request->send(204);
+        });
+
+    shellRegister("trace", "Dump / Clear Loop Trace [clear]", cmdTrace);
+}
+
+#else
+
+#define PROFILE_SPAN(name)
+
+#endif
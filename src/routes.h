@@ -0,0 +1,170 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// static GET routes and captive portal probes
+//
+// every route lives in one table that is indexed by a perfect hash of its
+// path. the hash seed is checked at compile time, so a request is dispatched
+// with one hash, one slot lookup and one strcmp -- ahead of AsyncWebServer's
+// linear handler scan and the LittleFS lookup in onNotFound.
+//
+// OS connectivity probes never touch the filesystem. in AP mode they are
+// redirected to the portal so the OS pops its captive portal sheet, otherwise
+// they get the minimal "you are online" answer the OS looks for.
+
+#define ROUTE_SLOT_BITS     5
+#define ROUTE_SLOTS         (1 << ROUTE_SLOT_BITS)
+// FNV-1a offset basis nudged until the slots below are collision free
+#define ROUTE_HASH_SEED     0x811C9E97UL
+
+typedef void (*route_handler_t)(AsyncWebServerRequest* request);
+
+typedef struct route_entry {
+    const char* path;
+    route_handler_t handler;    // NULL => connectivity probe
+    short probe_code;           // status returned to probes outside AP mode
+    const char* probe_type;
+    const char* probe_body;
+} ROUTE_ENTRY;
+
+constexpr uint32_t routeHash(const char* s, uint32_t h = ROUTE_HASH_SEED) {
+    return *s ? routeHash(s + 1, (h ^ (uint8_t) *s) * 16777619UL) : h;
+}
+
+constexpr uint32_t routeSlot(const char* s) {
+    return routeHash(s) >> (32 - ROUTE_SLOT_BITS);
+}
+
+void routeRoot(AsyncWebServerRequest* request) {
+    ap_mode_activity = true;
+    request->redirect("/index.html");
+}
+
+void routeSetup(AsyncWebServerRequest* request) {
+    request->send(LittleFS, "/setup.html", "text/html");
+}
+
+void routeReboot(AsyncWebServerRequest* request) {
+    request->redirect("/index.html");
+    esp_reboot_requested = true;
+}
+
+void routeSave(AsyncWebServerRequest* request) {
+    if (!request->hasParam("hostname") || !request->hasParam("ssid") || !request->hasParam("ssid_pwd")) {
+        request->send(400, "text/plain", "hostname, ssid and ssid_pwd are required");
+        return;
+    }
+
+    saveConfig(request->getParam("hostname")->value().c_str(),
+               request->getParam("ssid")->value().c_str(),
+               request->getParam("ssid_pwd")->value().c_str());
+
+    request->redirect("/index.html");
+}
+
+void routeLoad(AsyncWebServerRequest* request) {
+    LOG_PRINTLN();
+    wireConfig();
+    setup_needs_update = true;
+    request->redirect("/index.html");
+}
+
+void routeWipe(AsyncWebServerRequest* request) {
+    const boolean reboot = !request->hasParam("noreboot");
+
+    wipeConfig();
+    request->redirect("/index.html");
+
+    // trigger a reboot
+    if (reboot) esp_reboot_requested = true;
+}
+
+constexpr ROUTE_ENTRY routes[] = {
+    { "/",                              routeRoot,   0,   NULL,         NULL },
+    { "/setup",                         routeSetup,  0,   NULL,         NULL },
+    { "/reboot",                        routeReboot, 0,   NULL,         NULL },
+    { "/save",                          routeSave,   0,   NULL,         NULL },
+    { "/save/",                         routeSave,   0,   NULL,         NULL },
+    { "/load",                          routeLoad,   0,   NULL,         NULL },
+    { "/wipe",                          routeWipe,   0,   NULL,         NULL },
+    // apple
+    { "/hotspot-detect.html",           NULL,        200, "text/html",  "<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>" },
+    { "/library/test/success.html",     NULL,        200, "text/html",  "<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>" },
+    // android / chrome os
+    { "/generate_204",                  NULL,        204, NULL,         NULL },
+    { "/gen_204",                       NULL,        204, NULL,         NULL },
+    // windows
+    { "/ncsi.txt",                      NULL,        200, "text/plain", "Microsoft NCSI" },
+    { "/connecttest.txt",               NULL,        200, "text/plain", "Microsoft Connect Test" },
+    { "/redirect",                      NULL,        204, NULL,         NULL },
+    { "/fwlink",                        NULL,        204, NULL,         NULL },
+    // kindle / firefox
+    { "/check_network_status.txt",      NULL,        200, "text/plain", "1" },
+    { "/success.txt",                   NULL,        200, "text/plain", "success\n" },
+    { "/canonical.html",                NULL,        200, "text/html",  "<meta http-equiv=\"refresh\" content=\"0;url=https://support.mozilla.org/kb/captive-portal\"/>" },
+};
+
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+
+constexpr bool routeCollides(size_t i, size_t j) {
+    return j >= ROUTE_COUNT ? false : (routeSlot(routes[i].path) == routeSlot(routes[j].path) || routeCollides(i, j + 1));
+}
+
+constexpr bool routesArePerfect(size_t i = 0) {
+    return i >= ROUTE_COUNT ? true : (!routeCollides(i, i + 1) && routesArePerfect(i + 1));
+}
+
+static_assert(ROUTE_COUNT <= ROUTE_SLOTS, "too many routes for ROUTE_SLOTS");
+static_assert(routesArePerfect(), "route hash collision -- pick a new ROUTE_HASH_SEED");
+
+const ROUTE_ENTRY* route_slots[ROUTE_SLOTS];
+char portal_url[40];                // filled in by wifiStartAP() once the AP has its ip
+
+const ROUTE_ENTRY* routeLookup(const char* path) {
+    uint32_t h = ROUTE_HASH_SEED;
+    for (const char* p = path; *p; p++) h = (h ^ (uint8_t) *p) * 16777619UL;
+
+    const ROUTE_ENTRY* route = route_slots[h >> (32 - ROUTE_SLOT_BITS)];
+    return route != NULL && strcmp(route->path, path) == 0 ? route : NULL;
+}
+
+class RouteTableHandler : public AsyncWebHandler {
+    public:
+        bool canHandle(AsyncWebServerRequest* request) override {
+            return request->method() == HTTP_GET && routeLookup(request->url().c_str()) != NULL;
+        }
+
+        void handleRequest(AsyncWebServerRequest* request) override {
+            const ROUTE_ENTRY* route = routeLookup(request->url().c_str());
+
+            if (route->handler != NULL) {
+                route->handler(request);
+            } else if (wifimode == WIFI_AP) {
+                ap_mode_activity = true;
+                request->redirect(portal_url);
+            } else if (route->probe_body == NULL) {
+                request->send(route->probe_code);
+            } else {
+                request->send(route->probe_code, route->probe_type, route->probe_body);
+            }
+
+            LOG_DEBUG(HTTP, "\n%s handled\n", request->url().c_str());
+        }
+};
+
+RouteTableHandler route_handler;
+
+void wireRoutes() {
+    memset(route_slots, 0, sizeof(route_slots));
+    for (size_t i = 0; i < ROUTE_COUNT; i++) {
+        route_slots[routeSlot(routes[i].path)] = &routes[i];
+    }
+
+    // registered ahead of the api handlers and the onNotFound file lookup
+    server.addHandler(&route_handler);
+}
@@ -0,0 +1,143 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// cooperative scheduler
+//
+// loop() work is registered as tasks with a period, a priority and a time
+// budget. every pass schedulerRun() runs each due task once, lowest priority
+// number first and earliest deadline within a priority. priority 0 tasks
+// (IR decode) are polled again before every other task, so one slow task
+// cannot hold a capture back for a whole pass.
+//
+// a task returns true when it has more work; it is then due again on the
+// next pass instead of after its period. long jobs check schedulerBudgetLeft()
+// and stop early. a run that takes longer than its budget counts as overrun.
+// with PROFILER every run is also recorded as a trace span.
+
+#define SCHED_MAX_TASKS         16
+
+typedef bool (*SCHED_FN)();
+
+typedef struct sched_task {
+    const char* name;
+    SCHED_FN fn;
+    uint32_t period_us;         // 0 => every pass
+    uint32_t budget_us;
+    uint8_t priority;           // 0 => polled before every other task
+    uint32_t due_us;
+    bool more;                  // yielded with work left
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t total_us;
+    uint32_t max_us;
+} SCHED_TASK;
+
+SCHED_TASK sched_tasks[SCHED_MAX_TASKS];
+tiny_int sched_task_count = 0;
+SCHED_TASK* sched_current = NULL;
+uint32_t sched_start_us = 0;
+
+bool schedulerAdd(const char* name, SCHED_FN fn, uint32_t period_ms, uint8_t priority, uint32_t budget_us) {
+    if (sched_task_count >= SCHED_MAX_TASKS) {
+        LOG_ERROR(CORE, "\nscheduler: no room for task [%s]\n", name);
+        return false;
+    }
+
+    SCHED_TASK* task = &sched_tasks[sched_task_count++];
+    memset(task, 0, sizeof(SCHED_TASK));
+    task->name = name;
+    task->fn = fn;
+    task->period_us = period_ms * 1000UL;
+    task->priority = priority;
+    task->budget_us = budget_us;
+    task->due_us = micros();
+    return true;
+}
+
+// for long jobs: true while the running task is inside its budget
+bool schedulerBudgetLeft() {
+    return sched_current == NULL || micros() - sched_start_us < sched_current->budget_us;
+}
+
+void schedulerExec(SCHED_TASK* task) {
+    sched_current = task;
+    sched_start_us = micros();
+
+    {
+        PROFILE_SPAN(task->name);
+        task->more = task->fn();
+    }
+
+    const uint32_t now = micros();
+    const uint32_t elapsed = now - sched_start_us;
+    sched_current = NULL;
+
+    task->runs++;
+    task->total_us += elapsed;
+    if (elapsed > task->max_us) task->max_us = elapsed;
+    if (elapsed > task->budget_us) {
+        task->overruns++;
+        LOG_TRACE(CORE, "scheduler: %s took %u us (budget %u us)\n", task->name, (unsigned int) elapsed, (unsigned int) task->budget_us);
+    }
+
+    // a task that fell behind restarts from now instead of catching up
+    task->due_us = task->more ? now : (((int32_t) (now - task->due_us - task->period_us) > 0) ? now : task->due_us) + task->period_us;
+}
+
+bool schedulerDue(const SCHED_TASK* task, uint32_t now) {
+    return task->more || (int32_t) (now - task->due_us) >= 0;
+}
+
+void schedulerPollCritical() {
+    const uint32_t now = micros();
+    for (tiny_int i = 0; i < sched_task_count; i++) {
+        if (sched_tasks[i].priority == 0 && schedulerDue(&sched_tasks[i], now)) schedulerExec(&sched_tasks[i]);
+    }
+}
+
+// one pass over all due tasks
+void schedulerRun() {
+    uint32_t ran = 0;   // bit per task run in this pass
+
+    schedulerPollCritical();
+
+    while (true) {
+        const uint32_t now = micros();
+        SCHED_TASK* next = NULL;
+        tiny_int next_i = 0;
+
+        for (tiny_int i = 0; i < sched_task_count; i++) {
+            SCHED_TASK* task = &sched_tasks[i];
+            if (task->priority == 0 || (ran & (1UL << i)) || !schedulerDue(task, now)) continue;
+            if (next == NULL || task->priority < next->priority ||
+                (task->priority == next->priority && (int32_t) (task->due_us - next->due_us) < 0)) {
+                next = task;
+                next_i = i;
+            }
+        }
+        if (next == NULL) break;
+
+        ran |= 1UL << next_i;
+        schedulerExec(next);
+        schedulerPollCritical();
+    }
+}
+
+void cmdTasks(int argc, char** argv) {
+    CONSOLE_PRINTLN("\ntask       prio  period ms  budget us  runs      avg us  max us  overruns");
+    for (tiny_int i = 0; i < sched_task_count; i++) {
+        const SCHED_TASK* task = &sched_tasks[i];
+        CONSOLE_PRINTF("%-10s %4u  %9u  %9u  %-8u  %6u  %6u  %8u\n", task->name, task->priority,
+            (unsigned int) (task->period_us / 1000), (unsigned int) task->budget_us, (unsigned int) task->runs,
+            (unsigned int) (task->runs ? task->total_us / task->runs : 0), (unsigned int) task->max_us, (unsigned int) task->overruns);
+    }
+}
+
+void wireScheduler() {
+    shellRegister("tasks", "Scheduler Task Stats", cmdTasks);
+}
@@ -0,0 +1,179 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// serial / telnet command shell
+//
+// input is collected into a line by a small editor that takes at most
+// SHELL_CHUNK characters per coreLoop() pass, so typing never holds up IR
+// capture, the web server or OTA. a finished line is split into argc / argv
+// (double quotes keep spaces) and dispatched through the command table.
+// modules add their own commands with shellRegister() from their wire
+// function. commands that need more input ask for it with shellPrompt(),
+// the next line is then handed to the given callback instead.
+
+#define SHELL_MAX_COMMANDS      32
+#define SHELL_LINE_LEN          96
+#define SHELL_MAX_ARGS          8
+#define SHELL_CHUNK             32
+
+typedef void (*SHELL_HANDLER)(int argc, char** argv);
+typedef void (*SHELL_PROMPT_HANDLER)(char* line);
+
+typedef struct shell_command {
+    const char* name;
+    const char* help;
+    SHELL_HANDLER handler;
+} SHELL_COMMAND;
+
+SHELL_COMMAND shell_commands[SHELL_MAX_COMMANDS];
+tiny_int shell_command_count = 0;
+
+char shell_line[SHELL_LINE_LEN];
+uint8_t shell_len = 0;
+bool shell_after_cr = false;
+
+SHELL_PROMPT_HANDLER shell_prompt_handler = NULL;
+bool shell_masked = false;
+
+// adds a command, a command registered again replaces the old entry
+bool shellRegister(const char* name, const char* help, SHELL_HANDLER handler) {
+    for (tiny_int i = 0; i < shell_command_count; i++) {
+        if (strcasecmp(shell_commands[i].name, name) == 0) {
+            shell_commands[i].help = help;
+            shell_commands[i].handler = handler;
+            return true;
+        }
+    }
+
+    if (shell_command_count >= SHELL_MAX_COMMANDS) {
+        LOG_ERROR(CORE, "\nshell: no room for command [%s]\n", name);
+        return false;
+    }
+
+    shell_commands[shell_command_count++] = { name, help, handler };
+    return true;
+}
+
+// the next line goes to handler instead of the command table
+void shellPrompt(const char* text, SHELL_PROMPT_HANDLER handler, bool masked = false) {
+    CONSOLE_PRINTF("\n%s\n", text);
+    shell_prompt_handler = handler;
+    shell_masked = masked;
+}
+
+void shellHelp(int argc, char** argv) {
+    CONSOLE_PRINT("\n\nCommands:\n\n");
+    for (tiny_int i = 0; i < shell_command_count; i++) {
+        CONSOLE_PRINTF("%-10s %s\n", shell_commands[i].name, shell_commands[i].help);
+    }
+    CONSOLE_PRINTLN();
+}
+
+// splits line in place, returns argc
+int shellSplit(char* line, char** argv) {
+    int argc = 0;
+    char* p = line;
+
+    while (argc < SHELL_MAX_ARGS) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+
+        if (*p == '"') {
+            argv[argc++] = ++p;
+            while (*p != '\0' && *p != '"') p++;
+        } else {
+            argv[argc++] = p;
+            while (*p != '\0' && *p != ' ' && *p != '\t') p++;
+        }
+        if (*p == '\0') break;
+        *p++ = '\0';
+    }
+
+    return argc;
+}
+
+void shellExecute(char* line) {
+    char* argv[SHELL_MAX_ARGS];
+    const int argc = shellSplit(line, argv);
+    if (argc == 0) return;
+
+    if (strcmp(argv[0], "?") == 0) {
+        shellHelp(argc, argv);
+        return;
+    }
+
+    for (tiny_int i = 0; i < shell_command_count; i++) {
+        if (strcasecmp(shell_commands[i].name, argv[0]) == 0) {
+            shell_commands[i].handler(argc, argv);
+            return;
+        }
+    }
+
+    CONSOLE_PRINTF("\nUnknown command [%s] - type help for a list of commands\n", argv[0]);
+}
+
+void shellLine() {
+    shell_line[shell_len] = '\0';
+    shell_len = 0;
+    CONSOLE_PRINT("\r\n");
+
+    if (shell_prompt_handler != NULL) {
+        // a prompt takes any line, even an empty one
+        SHELL_PROMPT_HANDLER handler = shell_prompt_handler;
+        shell_prompt_handler = NULL;
+        shell_masked = false;
+        handler(shell_line);
+    } else {
+        shellExecute(shell_line);
+    }
+    LOG_FLUSH();
+}
+
+// line editor, fed once per loop pass
+void shellPoll() {
+    for (tiny_int n = 0; n < SHELL_CHUNK && SerialAndTelnet.available() > 0; n++) {
+        const int c = SerialAndTelnet.read();
+        if (c < 0) break;
+
+        const bool after_cr = shell_after_cr;
+        shell_after_cr = c == '\r';
+
+        switch (c) {
+        case '\n':
+            // CR LF ends one line only
+            if (after_cr) break;
+            // fall through
+        case '\r':
+            shellLine();
+            break;
+        case '\b':
+        case 0x7F:
+            if (shell_len > 0) {
+                shell_len--;
+                CONSOLE_PRINT("\b \b");
+            }
+            break;
+        case 0x15:  // ctrl-u
+            while (shell_len > 0) {
+                shell_len--;
+                CONSOLE_PRINT("\b \b");
+            }
+            break;
+        default:
+            if (c >= ' ' && c < 0x7F && shell_len < SHELL_LINE_LEN - 1) {
+                shell_line[shell_len++] = c;
+                CONSOLE_PRINT(shell_masked ? '*' : (char) c);
+            }
+            break;
+        }
+    }
+}
+
+void wireShell() {
+    shellRegister("help", "List commands", shellHelp);
+}
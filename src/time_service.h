@@ -0,0 +1,98 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// time service
+//
+// timestamps are kept as 64-bit epoch microseconds and only turned into
+// text, into a caller buffer, when somebody reads them. until NTP syncs the
+// clock runs on the 64-bit uptime counter; timeRefresh() notices the sync
+// once per second and from then on adds the epoch offset. uptime stamps taken
+// before the sync are moved onto the wall clock by timeCorrect(), so a
+// capture from the first second of boot still shows its real time later.
+// timeNowUs() never goes backwards, even when NTP steps the clock back.
+//
+// the broken-down local time of the current second is cached, formatting a
+// stamp from the same minute only patches the seconds instead of running
+// the TZ conversion again.
+
+#define TIME_TEXT_LEN           20                  // "2023-01-31 23:59:59"
+#define TIME_EPOCH_VALID_S      1600000000UL        // earlier => not synced yet
+#define TIME_EPOCH_VALID_US     ((uint64_t) TIME_EPOCH_VALID_S * 1000000ULL)
+
+bool time_synced = false;
+int64_t time_offset_us = 0;         // epoch - uptime
+uint64_t time_last_us = 0;
+time_t time_cache_s = 0;
+struct tm time_cache_tm;
+
+uint64_t timeUptimeUs() {
+#ifdef esp32
+    return (uint64_t) esp_timer_get_time();
+#else
+    return micros64();
+#endif
+}
+
+// epoch microseconds, uptime microseconds until NTP syncs
+uint64_t timeNowUs() {
+    uint64_t now = timeUptimeUs();
+    if (time_synced) now += time_offset_us;
+
+    if (now < time_last_us) now = time_last_us;
+    time_last_us = now;
+    return now;
+}
+
+// moves a stamp taken before the sync onto the wall clock
+uint64_t timeCorrect(uint64_t ts) {
+    if (time_synced && ts < TIME_EPOCH_VALID_US) return ts + time_offset_us;
+    return ts;
+}
+
+void timeLocal(time_t sec, struct tm* tm) {
+    if (time_cache_s != 0 && sec / 60 == time_cache_s / 60) {
+        *tm = time_cache_tm;
+        tm->tm_sec += sec - time_cache_s;
+        return;
+    }
+    localtime_r(&sec, tm);
+}
+
+// formats ts into buf, returns buf
+char* timeFormat(uint64_t ts, char* buf, size_t len) {
+    ts = timeCorrect(ts);
+
+    if (ts < TIME_EPOCH_VALID_US) {
+        const uint32_t ms = (uint32_t) (ts / 1000ULL % 1000ULL);
+        snprintf(buf, len, "%06lu.%03lu", (unsigned long) (ts / 1000000ULL), (unsigned long) ms);
+        return buf;
+    }
+
+    struct tm tm;
+    timeLocal((time_t) (ts / 1000000ULL), &tm);
+    snprintf(buf, len, "%4d-%2.2d-%2.2d %2.2d:%2.2d:%2.2d",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    return buf;
+}
+
+// clock task, once per second: picks up NTP and caches the local time
+bool timeRefresh() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < (time_t) TIME_EPOCH_VALID_S) return false;
+
+    time_offset_us = (int64_t) tv.tv_sec * 1000000LL + tv.tv_usec - (int64_t) timeUptimeUs();
+    if (!time_synced) {
+        time_synced = true;
+        LOG_INFO(CORE, "time: NTP synced %lu s after boot\n", (unsigned long) (timeUptimeUs() / 1000000ULL));
+    }
+
+    localtime_r(&tv.tv_sec, &time_cache_tm);
+    time_cache_s = tv.tv_sec;
+    return false;
+}
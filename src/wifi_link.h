@@ -0,0 +1,310 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// wi-fi station link
+//
+// a small state machine advanced once per coreLoop() pass, nothing in here
+// waits. a join first tries the cached access point (see wifiCacheStore),
+// then an async scan picks the strongest bssid of our ssid. failed joins back
+// off exponentially. while connected a weak signal triggers a background scan
+// and the link roams to a clearly stronger bssid. the device only reboots
+// after WIFI_LINK_REBOOT_S without a connection; if the very first connect
+// after boot fails it falls back to AP mode as before.
+
+#ifndef WIFI_LINK_REBOOT_S
+#define WIFI_LINK_REBOOT_S          900     // outage that triggers a reboot
+#endif
+#define WIFI_LINK_SETUP_MS          60000UL // first connect before falling back to AP mode
+#define WIFI_LINK_JOIN_MS           15000UL
+#define WIFI_LINK_BACKOFF_MS        1000UL
+#define WIFI_LINK_BACKOFF_MAX_MS    60000UL
+#define WIFI_LINK_SCAN_MS           10000UL // an async scan takes a few seconds, then it is given up
+#define WIFI_LINK_ROAM_CHECK_MS     60000UL
+#define WIFI_LINK_ROAM_RSSI         -72     // look for a better bssid below this
+#define WIFI_LINK_ROAM_MARGIN       8       // dB a new bssid must be stronger
+
+typedef enum wifi_link_state {
+    LINK_OFF = 0,       // AP mode or not started
+    LINK_FAST,          // joining the cached bssid / channel
+    LINK_SCAN,          // async scan for the strongest bssid
+    LINK_JOIN,          // joining the scanned bssid
+    LINK_UP,
+    LINK_ROAM_SCAN,     // connected, scanning for a stronger bssid
+    LINK_BACKOFF
+} WIFI_LINK_STATE;
+
+typedef struct wifi_link {
+    WIFI_LINK_STATE state;
+    unsigned long state_ms;     // when the state was entered
+    unsigned long down_ms;      // when the link went down (boot for the first connect)
+    unsigned long backoff_ms;
+    unsigned long roam_ms;
+    uint8_t attempts;           // failed joins since the link went down
+    bool ever_up;
+    unsigned long first_up_ms;  // boot to first connection
+    uint32_t reconnects;
+    uint32_t roams;
+} WIFI_LINK;
+
+WIFI_LINK wifi_link;
+
+const char* wifiLinkStateName(WIFI_LINK_STATE state) {
+    switch (state) {
+        case LINK_FAST:         return "fast join";
+        case LINK_SCAN:         return "scanning";
+        case LINK_JOIN:         return "joining";
+        case LINK_UP:           return "up";
+        case LINK_ROAM_SCAN:    return "roam scan";
+        case LINK_BACKOFF:      return "backoff";
+        default:                return "off";
+    }
+}
+
+void wifiLinkEnter(WIFI_LINK_STATE state) {
+    LOG_DEBUG(WIFI, "\nwifi link: %s -> %s\n", wifiLinkStateName(wifi_link.state), wifiLinkStateName(state));
+    wifi_link.state = state;
+    wifi_link.state_ms = millis();
+}
+
+void wifiStartAP() {
+    WiFi.scanDelete();
+    WiFi.disconnect();
+    wifimode = WIFI_AP;
+    WiFi.mode(wifimode);
+    WiFi.softAP(config.hostname);
+    dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());
+    wifiLinkEnter(LINK_OFF);
+    const IPAddress ap_ip = WiFi.softAPIP();
+    snprintf(portal_url, sizeof(portal_url), "http://" LOG_IP_FMT "/index.html", LOG_IP_ARGS(ap_ip));
+    LOG_INFO(WIFI, "\nSoftAP [%s] started - IP address: " LOG_IP_FMT "\n", config.hostname, LOG_IP_ARGS(ap_ip));
+}
+
+void wifiLinkStartScan() {
+    LOG_INFO(WIFI, "\nScanning Wi-Fi networks. . .\n");
+    WiFi.scanDelete();
+    WiFi.scanNetworks(true);
+    wifiLinkEnter(LINK_SCAN);
+}
+
+void wifiLinkJoin() {
+    // the cached access point first, a scan once that failed
+    if (wifi_link.attempts == 0 && config.wifi_cache_flag == CFG_SET) {
+        const uint8_t* b = config.wifi_bssid;
+        LOG_INFO(WIFI, "\nConnecting to %s via %02x:%02x:%02x:%02x:%02x:%02x / channel %d\n",
+            config.ssid, b[0], b[1], b[2], b[3], b[4], b[5], config.wifi_channel);
+#ifdef WIFI_CACHE_LEASE
+        // skip dhcp as well, the lease is renewed by the next scan join
+        if (config.wifi_ip != 0) {
+            WiFi.config(IPAddress(config.wifi_ip), IPAddress(config.wifi_gateway), IPAddress(config.wifi_subnet), IPAddress(config.wifi_dns));
+        }
+#endif
+        WiFi.begin(config.ssid, config.ssid_pwd, config.wifi_channel, config.wifi_bssid, true);
+        wifiLinkEnter(LINK_FAST);
+    } else {
+        wifiLinkStartScan();
+    }
+}
+
+void wifiLinkFailed(const char* why) {
+    wifi_link.attempts++;
+    wifi_link.backoff_ms = min(WIFI_LINK_BACKOFF_MS << min(wifi_link.attempts - 1, 6), WIFI_LINK_BACKOFF_MAX_MS);
+    LOG_WARN(WIFI, "\nWi-Fi join failed (%s) - retry %u in %lu ms\n", why, wifi_link.attempts, wifi_link.backoff_ms);
+
+#ifdef WIFI_CACHE_LEASE
+    if (wifi_link.state == LINK_FAST) WiFi.config(IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+#endif
+    WiFi.disconnect();
+    wifiLinkEnter(LINK_BACKOFF);
+}
+
+// strongest bssid of our ssid from the finished scan, -1 if none
+int wifiLinkBestScan(int n) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        LOG_DEBUG(WIFI, "   ssid: %s - rssi: %d\n", WiFi.SSID(i).c_str(), WiFi.RSSI(i));
+        if (WiFi.SSID(i).equals(config.ssid) && (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best))) best = i;
+    }
+    return best;
+}
+
+void wifiLinkUp() {
+    wifi_link.attempts = 0;
+    wifi_link.roam_ms = millis();
+    wifiState = WIFI_EVENT_MAX;
+    wifiLinkEnter(LINK_UP);
+
+    const IPAddress ip = WiFi.localIP();
+    LOG_INFO(WIFI, "\nConnected to %s - IP address: " LOG_IP_FMT " - RSSI: %d dB\n", config.ssid, LOG_IP_ARGS(ip), WiFi.RSSI());
+    if (wifi_link.ever_up) {
+        wifi_link.reconnects++;
+        LOG_INFO(WIFI, "Wi-Fi back after %lu ms\n", millis() - wifi_link.down_ms);
+    } else {
+        wifi_link.ever_up = true;
+        wifi_link.first_up_ms = millis();
+        LOG_INFO(WIFI, "Wi-Fi connected %lu ms after boot\n", wifi_link.first_up_ms);
+
+        // initialize time
+        configTime(0, 0, "pool.ntp.org");
+        setenv("TZ", "EST+5EDT,M3.2.0/2,M11.1.0/2", 1);
+        tzset();
+    }
+
+    wifiCacheStore();
+}
+
+void wifiLinkDown() {
+    wifi_link.down_ms = millis();
+    wifi_link.attempts = 0;
+    LOG_WARN(WIFI, "\nWi-Fi link lost - reconnecting\n");
+    WiFi.scanDelete();
+    wifiLinkJoin();
+}
+
+void wifiLinkLoop() {
+    if (wifimode != WIFI_STA || wifi_link.state == LINK_OFF) return;
+
+    const unsigned long now = millis();
+    const unsigned long in_state = now - wifi_link.state_ms;
+    const wl_status_t status = WiFi.status();
+
+    if (wifi_link.state != LINK_UP && wifi_link.state != LINK_ROAM_SCAN) {
+        if (!wifi_link.ever_up && now - wifi_link.down_ms >= WIFI_LINK_SETUP_MS) {
+            LOG_WARN(WIFI, "\nNo Wi-Fi connection after %lu ms - falling back to AP mode\n", now - wifi_link.down_ms);
+            wifiStartAP();
+            return;
+        }
+        if (wifi_link.ever_up && now - wifi_link.down_ms >= WIFI_LINK_REBOOT_S * 1000UL && !esp_reboot_requested) {
+            LOG_ERROR(WIFI, "\nRebooting after %u s without wifi connection\n", (unsigned int) WIFI_LINK_REBOOT_S);
+            crashlogNote(CRASH_WIFI, config.ssid);
+            esp_reboot_requested = true;
+            return;
+        }
+    }
+
+    switch (wifi_link.state) {
+    case LINK_FAST:
+    case LINK_JOIN:
+        if (status == WL_CONNECTED) {
+            wifiLinkUp();
+        } else if (status == WL_CONNECT_FAILED || status == WL_NO_SSID_AVAIL) {
+            wifiLinkFailed(status == WL_NO_SSID_AVAIL ? "no ssid" : "rejected");
+        } else if (in_state >= (wifi_link.state == LINK_FAST ? WIFI_FAST_CONNECT_MS : WIFI_LINK_JOIN_MS)) {
+            wifiLinkFailed("timeout");
+        }
+        break;
+    case LINK_SCAN:
+    {
+        const int n = WiFi.scanComplete();
+        if (n == WIFI_SCAN_RUNNING) {
+            if (in_state < WIFI_LINK_SCAN_MS) break;
+            WiFi.scanDelete();
+            wifiLinkFailed("scan timeout");
+            break;
+        }
+
+        const int best = n > 0 ? wifiLinkBestScan(n) : -1;
+        if (best < 0) {
+            WiFi.scanDelete();
+            wifiLinkFailed(n < 0 ? "scan failed" : "ssid not found");
+            break;
+        }
+
+        // arduino is too stupid to know which AP has the best signal
+        // when connecting to an SSID with multiple BSSIDs (WAPs / Repeaters)
+        // so we find the best one and tell it to use it
+        LOG_INFO(WIFI, "\nConnecting to %s / %d dB\n", config.ssid, WiFi.RSSI(best));
+        WiFi.begin(config.ssid, config.ssid_pwd, WiFi.channel(best), WiFi.BSSID(best), true);
+        WiFi.scanDelete();
+        wifiLinkEnter(LINK_JOIN);
+    }
+    break;
+    case LINK_BACKOFF:
+        if (in_state >= wifi_link.backoff_ms) wifiLinkJoin();
+        break;
+    case LINK_UP:
+        if (status != WL_CONNECTED || wifiState == WIFI_DISCONNECTED) {
+            wifiLinkDown();
+        } else if (now - wifi_link.roam_ms >= WIFI_LINK_ROAM_CHECK_MS) {
+            wifi_link.roam_ms = now;
+            if (WiFi.RSSI() < WIFI_LINK_ROAM_RSSI) {
+                LOG_DEBUG(WIFI, "\nWeak signal (%d dB) - looking for a better access point\n", WiFi.RSSI());
+                WiFi.scanDelete();
+                WiFi.scanNetworks(true);
+                wifiLinkEnter(LINK_ROAM_SCAN);
+            }
+        }
+        break;
+    case LINK_ROAM_SCAN:
+    {
+        if (status != WL_CONNECTED || wifiState == WIFI_DISCONNECTED) {
+            wifiLinkDown();
+            break;
+        }
+
+        const int n = WiFi.scanComplete();
+        if (n == WIFI_SCAN_RUNNING) {
+            // still connected, try again at the next roam check
+            if (in_state < WIFI_LINK_SCAN_MS) break;
+            LOG_DEBUG(WIFI, "\nRoam scan timed out\n");
+            WiFi.scanDelete();
+            wifiLinkEnter(LINK_UP);
+            break;
+        }
+
+        const int best = n > 0 ? wifiLinkBestScan(n) : -1;
+        const int rssi = WiFi.RSSI();
+        if (best >= 0 && memcmp(WiFi.BSSID(best), WiFi.BSSID(), 6) != 0 && WiFi.RSSI(best) >= rssi + WIFI_LINK_ROAM_MARGIN) {
+            LOG_INFO(WIFI, "\nRoaming from %d dB to %d dB\n", rssi, WiFi.RSSI(best));
+            wifi_link.roams++;
+            wifi_link.down_ms = now;
+            WiFi.begin(config.ssid, config.ssid_pwd, WiFi.channel(best), WiFi.BSSID(best), true);
+            WiFi.scanDelete();
+            wifiLinkEnter(LINK_JOIN);
+        } else {
+            WiFi.scanDelete();
+            wifiLinkEnter(LINK_UP);
+        }
+    }
+    break;
+    default:
+        break;
+    }
+}
+
+// true while the link is up or the current state is still within the time
+// it may take. every state times out on its own, so this only turns false
+// when wifiLinkLoop() stops advancing
+bool wifiLinkProgressing() {
+    const unsigned long in_state = millis() - wifi_link.state_ms;
+
+    switch (wifi_link.state) {
+        case LINK_UP:           return true;
+        case LINK_FAST:         return in_state <= WIFI_FAST_CONNECT_MS;
+        case LINK_JOIN:         return in_state <= WIFI_LINK_JOIN_MS;
+        case LINK_SCAN:
+        case LINK_ROAM_SCAN:    return in_state <= WIFI_LINK_SCAN_MS;
+        case LINK_BACKOFF:      return in_state <= wifi_link.backoff_ms;
+        default:                return false;
+    }
+}
+
+void wifiLinkBegin() {
+    memset(&wifi_link, 0, sizeof(wifi_link));
+    wifi_link.down_ms = millis();
+    wifiLinkJoin();
+}
+
+void cmdWifiLink(int argc, char** argv) {
+    CONSOLE_PRINTF("\nWi-Fi link: %s, rssi %d dB, %u reconnects, %u roams, %u failed joins\n",
+        wifimode == WIFI_AP ? "AP mode" : wifiLinkStateName(wifi_link.state), WiFi.RSSI(),
+        (unsigned int) wifi_link.reconnects, (unsigned int) wifi_link.roams, wifi_link.attempts);
+}
+
+void wireWifiLink() {
+    shellRegister("link", "Wi-Fi Link Status", cmdWifiLink);
+}
@@ -0,0 +1,224 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// config journal: record format, replay, compaction, EEPROM migration
+
+#include "firmware.h"
+#include "fs.h"
+
+CONFIG_TYPE config;
+
+#include "config_store.h"
+
+static void setString(tiny_int* flag, char* field, const char* value) {
+    strcpy(field, value);
+    *flag = CFG_SET;
+}
+
+// a fresh boot: the journal is replayed into an empty config
+static void reboot() {
+    config_store_ready = true;
+    configStoreLoad();
+}
+
+// first boot of an erased device, ends with an empty journal
+static void firstBoot() {
+    reboot();
+    config_compactions = 0;
+}
+
+static size_t journalSize() {
+    return mock_files.count(CONFIG_JOURNAL) ? mock_files[CONFIG_JOURNAL].size() : 0;
+}
+
+static void reset() {
+    mock_files.clear();
+    memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+    config_compactions = 0;
+}
+
+static void testCrc() {
+    // CRC-16/CCITT-FALSE check value
+    CHECK(configCrc(0xFFFF, (const uint8_t*) "123456789", 9) == 0x29B1, "crc %04x", configCrc(0xFFFF, (const uint8_t*) "123456789", 9));
+    CHECK(configCrc(configCrc(0xFFFF, (const uint8_t*) "1234", 4), (const uint8_t*) "56789", 5) == 0x29B1, "crc is not incremental");
+}
+
+static void testRecords() {
+    reset();
+    uint8_t value[CONFIG_VALUE_MAX];
+    tiny_int key;
+    uint8_t len;
+
+    File file = LittleFS.open("/records", FILE_WRITE);
+    CHECK(configWriteRecord(file, CFG_KEY_SSID, (const uint8_t*) "home", 4) == 8, "record size");
+    CHECK(configWriteRecord(file, CFG_KEY_HOSTNAME, (const uint8_t*) "", 0) == 4, "empty record size");
+    file.close();
+
+    file = LittleFS.open("/records", FILE_READ);
+    CHECK(configReadRecord(file, &key, value, &len) && key == CFG_KEY_SSID && len == 4 && memcmp(value, "home", 4) == 0, "first record");
+    CHECK(configReadRecord(file, &key, value, &len) && key == CFG_KEY_HOSTNAME && len == 0, "empty record");
+    CHECK(!configReadRecord(file, &key, value, &len), "read past the end");
+    file.close();
+
+    // one flipped bit fails the crc
+    mock_files["/records"][3] ^= 0x01;
+    file = LittleFS.open("/records", FILE_READ);
+    CHECK(!configReadRecord(file, &key, value, &len), "damaged record accepted");
+    file.close();
+
+    // a length over CONFIG_VALUE_MAX is never read into value
+    mock_files["/records"] = std::string("\x01\xFF", 2) + std::string(300, 'x');
+    file = LittleFS.open("/records", FILE_READ);
+    CHECK(!configReadRecord(file, &key, value, &len), "oversized record accepted");
+    file.close();
+}
+
+static void testKeySet() {
+    CONFIG_TYPE c;
+    memset(&c, CFG_NOT_SET, sizeof(c));
+    uint8_t value[CONFIG_VALUE_MAX];
+
+    configKeySet(&c, CFG_KEY_HOSTNAME, (const uint8_t*) "blaster", 7);
+    CHECK(c.hostname_flag == CFG_SET && strcmp(c.hostname, "blaster") == 0, "hostname [%s]", c.hostname);
+    CHECK(configKeyGet(&c, CFG_KEY_HOSTNAME, value) == 7 && memcmp(value, "blaster", 7) == 0, "hostname does not round trip");
+
+    // an empty value clears the key
+    configKeySet(&c, CFG_KEY_HOSTNAME, value, 0);
+    CHECK(c.hostname_flag == CFG_NOT_SET && configKeyGet(&c, CFG_KEY_HOSTNAME, value) == 0, "hostname not cleared");
+
+    // too long for the field: cut, still terminated
+    memset(value, 'a', sizeof(value));
+    configKeySet(&c, CFG_KEY_SSID, value, CONFIG_VALUE_MAX);
+    CHECK(strlen(c.ssid) == WIFI_SSID_LEN - 1, "ssid length %u", (unsigned int) strlen(c.ssid));
+
+    uint8_t cache[CFG_WIFI_CACHE_LEN];
+    for (size_t i = 0; i < sizeof(cache); i++) cache[i] = i + 1;
+    configKeySet(&c, CFG_KEY_WIFI_CACHE, cache, sizeof(cache));
+    CHECK(c.wifi_cache_flag == CFG_SET && c.wifi_channel == 7 && c.wifi_bssid[5] == 6, "wifi cache");
+    CHECK(configKeyGet(&c, CFG_KEY_WIFI_CACHE, value) == CFG_WIFI_CACHE_LEN && memcmp(value, cache, sizeof(cache)) == 0, "wifi cache does not round trip");
+    configKeySet(&c, CFG_KEY_WIFI_CACHE, cache, 5);
+    CHECK(c.wifi_cache_flag == CFG_NOT_SET, "short wifi cache accepted");
+
+    // keys from a newer firmware are skipped
+    CONFIG_TYPE before = c;
+    configKeySet(&c, CFG_KEYS + 3, cache, sizeof(cache));
+    CHECK(memcmp(&before, &c, sizeof(c)) == 0, "unknown key changed the config");
+}
+
+static void testMigration() {
+    reset();
+
+    CONFIG_TYPE old;
+    memset(&old, 0xFF, sizeof(old));    // erased flash
+    setString(&old.ssid_flag, old.ssid, "home");
+    setString(&old.ssid_pwd_flag, old.ssid_pwd, "secret");
+    memcpy(EEPROM.data, &old, sizeof(old));
+
+    reboot();
+    CHECK(config_schema == 1, "loaded as schema %u", config_schema);
+    CHECK(config.ssid_flag == CFG_SET && strcmp(config.ssid, "home") == 0, "ssid [%s]", config.ssid);
+    CHECK(config.hostname_flag == CFG_NOT_SET && config.wifi_cache_flag == CFG_NOT_SET, "erased flags taken as set");
+    CHECK(journalSize() > 0 && journalSize() == config_journal_size, "journal %u, tracked %u", (unsigned int) journalSize(), (unsigned int) config_journal_size);
+
+    // the EEPROM copy is not read again
+    memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+    reboot();
+    CHECK(config_schema == CONFIG_SCHEMA, "reloaded as schema %u", config_schema);
+    CHECK(strcmp(config.ssid, "home") == 0 && strcmp(config.ssid_pwd, "secret") == 0, "migrated values lost");
+}
+
+static void testAppend() {
+    reset();
+    firstBoot();
+
+    setString(&config.hostname_flag, config.hostname, "blaster");
+    CHECK(configStoreSave(), "save failed");
+    const size_t size = journalSize();
+
+    // nothing changed, nothing written
+    CHECK(configStoreSave() && journalSize() == size, "unchanged config appended");
+
+    // only the changed key is appended
+    config.wifi_cache_flag = CFG_SET;
+    config.wifi_channel = 11;
+    configStoreSave();
+    CHECK(journalSize() == size + CFG_WIFI_CACHE_LEN + 4, "appended %u bytes", (unsigned int) (journalSize() - size));
+
+    config.ssid_flag = CFG_SET;
+    strcpy(config.ssid, "home");
+    configStoreSave();
+    config.ssid_flag = CFG_NOT_SET;     // cleared again, an empty record
+    configStoreSave();
+
+    reboot();
+    CHECK(strcmp(config.hostname, "blaster") == 0 && config.wifi_channel == 11, "replay lost values");
+    CHECK(config.ssid_flag == CFG_NOT_SET, "cleared key came back");
+    CHECK(config_compactions == 0, "compacted %u times", (unsigned int) config_compactions);
+}
+
+static void testCompaction() {
+    reset();
+    firstBoot();
+    config.wifi_cache_flag = CFG_SET;
+
+    for (int i = 0; i < 100; i++) {
+        config.wifi_channel = i;
+        CHECK(configStoreSave(), "save %d failed", i);
+        CHECK(journalSize() <= CONFIG_JOURNAL_MAX, "journal at %u bytes", (unsigned int) journalSize());
+        CHECK(journalSize() == config_journal_size, "journal %u, tracked %u", (unsigned int) journalSize(), (unsigned int) config_journal_size);
+    }
+    CHECK(config_compactions > 0, "never compacted");
+    CHECK(mock_files.count(CONFIG_JOURNAL_TMP) == 0, "temp file left behind");
+
+    reboot();
+    CHECK(config.wifi_channel == 99, "channel %u after compactions", config.wifi_channel);
+}
+
+static void testTornRecord() {
+    reset();
+    firstBoot();
+    setString(&config.ssid_flag, config.ssid, "home");
+    configStoreSave();
+    const size_t size = journalSize();
+
+    // a reset in the middle of an append
+    mock_files[CONFIG_JOURNAL] += std::string("\x03\x05se", 4);
+    reboot();
+    CHECK(strcmp(config.ssid, "home") == 0, "values before the torn record lost");
+    CHECK(config_compactions == 1, "torn journal not compacted");
+    CHECK(journalSize() <= size && journalSize() == config_journal_size, "journal %u after compaction", (unsigned int) journalSize());
+
+    // compacted log replays cleanly
+    reboot();
+    CHECK(config_compactions == 1 && strcmp(config.ssid, "home") == 0, "compacted journal does not replay");
+
+    // a damaged header is no journal at all, the EEPROM copy is migrated
+    mock_files[CONFIG_JOURNAL][0] ^= 0xFF;
+    reboot();
+    CHECK(config_schema == 1 && config.ssid_flag == CFG_NOT_SET, "damaged header replayed");
+}
+
+static void testNoFileSystem() {
+    reset();
+    config_store_ready = false;
+    configStoreLoad();
+    CHECK(config_schema == 1, "schema %u without file system", config_schema);
+    CHECK(!configStoreSave(), "saved without file system");
+}
+
+int main() {
+    testCrc();
+    testRecords();
+    testKeySet();
+    testMigration();
+    testAppend();
+    testCompaction();
+    testTornRecord();
+    testNoFileSystem();
+    return testResult();
+}
@@ -0,0 +1,193 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// just enough of the esp8266 arduino core to build TelnetSpy on the host.
+// sockets are ClientState records the test fills and inspects. window is the
+// free space of the send buffer: every write() takes from it and is cut
+// short when it runs out, the test gives it back like acks from the peer.
+// write_cap cuts every write() short even with room left.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+extern std::atomic<unsigned long> mock_millis;
+inline unsigned long millis() { return mock_millis.load(); }
+inline unsigned long micros() { return mock_millis.load() * 1000UL; }
+
+class String {
+    public:
+        String(const char* s = "") : str(s) {}
+        const char* c_str() const { return str.c_str(); }
+    private:
+        std::string str;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* data, size_t len) {
+            size_t n = 0;
+            while (len--) n += write(*data++);
+            return n;
+        }
+        size_t write(const char* s) { return write((const uint8_t*) s, strlen(s)); }
+        size_t print(const char* s) { return write(s); }
+        size_t println(const char* s) { return write(s) + write("\r\n"); }
+        size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+            char buf[512];
+            va_list args;
+            va_start(args, fmt);
+            int n = vsnprintf(buf, sizeof(buf), fmt, args);
+            va_end(args);
+            return write((const uint8_t*) buf, min((size_t) n, sizeof(buf) - 1));
+        }
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+};
+
+enum SerialConfig { SERIAL_8N1 };
+enum SerialMode { SERIAL_FULL };
+
+class HardwareSerial : public Stream {
+    public:
+        std::string out;
+        std::deque<uint8_t> in;
+
+        size_t write(uint8_t c) override { out += (char) c; return 1; }
+        size_t write(const uint8_t* data, size_t len) override { out.append((const char*) data, len); return len; }
+        int available() override { return in.size(); }
+        int read() override {
+            if (in.empty()) return -1;
+            int c = in.front();
+            in.pop_front();
+            return c;
+        }
+        int peek() override { return in.empty() ? -1 : in.front(); }
+        int availableForWrite() override { return 128; }
+        void begin(unsigned long, SerialConfig, SerialMode, uint8_t) {}
+        void end() {}
+        void swap(uint8_t) {}
+        void set_tx(uint8_t) {}
+        void pins(uint8_t, uint8_t) {}
+        bool isTxEnabled() { return true; }
+        bool isRxEnabled() { return true; }
+        explicit operator bool() const { return true; }
+        uint32_t baudRate() { return 115200; }
+};
+
+extern HardwareSerial Serial;
+
+typedef struct client_state {
+    bool connected = true;
+    std::string sent;
+    std::deque<uint8_t> in;
+    std::atomic<size_t> window{2048};
+    size_t write_cap = SIZE_MAX;    // lwip may take less than it offered
+} ClientState;
+
+class WiFiClient {
+    public:
+        WiFiClient() {}
+        WiFiClient(ClientState* s) : state(s) {}
+        uint8_t connected() { return state && state->connected; }
+        size_t write(const uint8_t* data, size_t len) {
+            if (!state) return 0;
+            size_t room = state->window.load();
+            size_t n;
+            do {
+                n = min(min(len, room), state->write_cap);
+            } while (!state->window.compare_exchange_weak(room, room - n));
+            len = n;
+            state->sent.append((const char*) data, len);
+            return len;
+        }
+        size_t write(const char* data, size_t len) { return write((const uint8_t*) data, len); }
+        size_t write(uint8_t c) { return write(&c, 1); }
+        int available() { return state ? state->in.size() : 0; }
+        int read() {
+            if (!state || state->in.empty()) return -1;
+            int c = state->in.front();
+            state->in.pop_front();
+            return c;
+        }
+        int read(uint8_t* buf, size_t len) {
+            size_t n = 0;
+            while (n < len && state && !state->in.empty()) {
+                buf[n++] = state->in.front();
+                state->in.pop_front();
+            }
+            return n;
+        }
+        int peek() { return (!state || state->in.empty()) ? -1 : state->in.front(); }
+        int availableForWrite() { return state ? (int) state->window.load() : 0; }
+        void flush() {}
+        void stop() { if (state) state->connected = false; }
+        void setNoDelay(bool) {}
+        explicit operator bool() { return state != NULL; }
+    private:
+        ClientState* state = NULL;
+};
+
+extern std::deque<ClientState*> mock_pending_clients;
+
+class WiFiServer {
+    public:
+        WiFiServer(uint16_t) {}
+        void begin() {}
+        void close() {}
+        void setNoDelay(bool) {}
+        bool hasClient() { return !mock_pending_clients.empty(); }
+        WiFiClient accept() {
+            WiFiClient client(mock_pending_clients.front());
+            mock_pending_clients.pop_front();
+            return client;
+        }
+        WiFiClient available() { return accept(); }
+};
+
+#define NULL_MODE               0
+#define STATION_MODE            1
+#define SOFTAP_MODE             2
+#define STATIONAP_MODE          3
+#define WL_CONNECTED            3
+
+struct WiFiClass {
+    int getMode() { return STATION_MODE; }
+    int status() { return WL_CONNECTED; }
+};
+extern WiFiClass WiFi;
+
+struct EspClass {
+    void restart() {}
+};
+extern EspClass ESP;
+
+#define IRAM_ATTR
@@ -0,0 +1,3 @@
+// host build: WiFiClient lives in ESP8266WiFi.h
+#pragma once
+#include "ESP8266WiFi.h"
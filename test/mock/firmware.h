@@ -0,0 +1,58 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// what config.h provides to the header-only modules, for host tests that
+// include a module from src/ directly. the clock only moves when the test
+// moves mock_us; log and console output goes to stdout.
+
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include "config_type.h"
+
+inline uint64_t mock_us = 0;
+
+inline uint64_t micros64() { return mock_us; }
+inline uint32_t micros() { return (uint32_t) mock_us; }
+inline uint32_t millis() { return (uint32_t) (mock_us / 1000ULL); }
+
+#define LOG_ERROR(module, ...)      printf(__VA_ARGS__)
+#define LOG_WARN(module, ...)       printf(__VA_ARGS__)
+#define LOG_INFO(module, ...)       printf(__VA_ARGS__)
+#define LOG_DEBUG(module, ...)      do { } while (0)
+#define LOG_TRACE(module, ...)      do { } while (0)
+#define CONSOLE_PRINTLN(s)          puts(s)
+#define CONSOLE_PRINTF(...)         printf(__VA_ARGS__)
+
+#define PROFILE_SPAN(name)
+
+inline void shellRegister(const char* name, const char* help, void (*fn)(int, char**)) {}
+
+// minimal checks, a test exits non-zero when any failed
+inline int test_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+        } \
+    } while (0)
+
+inline int testResult() {
+    if (test_failures) fprintf(stderr, "%d failures\n", test_failures);
+    return test_failures ? 1 : 0;
+}
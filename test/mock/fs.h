@@ -0,0 +1,79 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// LittleFS and EEPROM in memory. files are strings in mock_files, so a
+// test can look at them, cut them short or damage them directly.
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+inline std::map<std::string, std::string> mock_files;
+
+class File {
+    public:
+        File() {}
+        File(std::string* data, size_t pos) : data(data), pos(pos) {}
+        explicit operator bool() const { return data != NULL; }
+        size_t write(const uint8_t* buf, size_t len) {
+            if (data == NULL) return 0;
+            data->replace(pos, len, (const char*) buf, len);
+            pos += len;
+            return len;
+        }
+        int read(uint8_t* buf, size_t len) {
+            if (data == NULL || pos >= data->size()) return 0;
+            len = std::min(len, data->size() - pos);
+            memcpy(buf, data->data() + pos, len);
+            pos += len;
+            return len;
+        }
+        size_t position() const { return pos; }
+        size_t size() const { return data ? data->size() : 0; }
+        void close() { data = NULL; }
+    private:
+        std::string* data = NULL;
+        size_t pos = 0;
+};
+
+struct MockFs {
+    File open(const char* path, const char* mode) {
+        if (mode[0] == 'r') {
+            auto it = mock_files.find(path);
+            return it == mock_files.end() ? File() : File(&it->second, 0);
+        }
+        std::string& data = mock_files[path];
+        if (mode[0] == 'w') data.clear();
+        return File(&data, data.size());
+    }
+    bool rename(const char* from, const char* to) {
+        auto it = mock_files.find(from);
+        if (it == mock_files.end()) return false;
+        mock_files[to] = it->second;
+        mock_files.erase(from);
+        return true;
+    }
+};
+
+inline MockFs LittleFS;
+
+// the schema 1 config at offset 0
+struct MockEeprom {
+    uint8_t data[EEPROM_SIZE];
+    void begin(size_t size) {}
+    void end() {}
+    template<typename T> void get(int offset, T& value) { memcpy(&value, &data[offset], sizeof(T)); }
+};
+
+inline MockEeprom EEPROM;
@@ -0,0 +1,21 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+#include "ESP8266WiFi.h"
+
+std::atomic<unsigned long> mock_millis{0};
+HardwareSerial Serial;
+std::deque<ClientState*> mock_pending_clients;
+WiFiClass WiFi;
+EspClass ESP;
+
+extern "C" {
+    void ets_putc(char c) {}
+    void ets_install_putc1(void (*putc)(char)) {}
+    void system_set_os_print(bool on) {}
+}
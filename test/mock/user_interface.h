@@ -0,0 +1,6 @@
+// host build: the os_print hooks TelnetSpy installs, see mock_arduino.cpp
+#pragma once
+
+void ets_putc(char c);
+void ets_install_putc1(void (*putc)(char));
+void system_set_os_print(bool on);
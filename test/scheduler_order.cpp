@@ -0,0 +1,151 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// scheduler: run order, yielding and overrun counting
+//
+// tasks append their name to a trace and move the mock clock by what they
+// "cost", so every pass of schedulerRun() is deterministic.
+
+#include "firmware.h"
+#include "scheduler.h"
+
+#include <string>
+
+static std::string trace;
+
+static void ran(const char* name, uint32_t cost_us) {
+    if (!trace.empty()) trace += ' ';
+    trace += name;
+    mock_us += cost_us;
+}
+
+static bool taskIr() { ran("ir", 10); return false; }
+static bool taskUi() { ran("ui", 100); return false; }
+static bool taskNet() { ran("net", 100); return false; }
+static bool taskSlow() { ran("slow", 3000); return false; }
+
+static int chunks_left = 0;
+
+// a long job: 400 us per chunk, stops when the budget is used up
+static bool taskLong() {
+    ran("long", 0);
+    while (chunks_left > 0) {
+        mock_us += 400;
+        chunks_left--;
+        if (!schedulerBudgetLeft()) break;
+    }
+    return chunks_left > 0;
+}
+
+static void reset() {
+    sched_task_count = 0;
+    trace.clear();
+    mock_us = 1000000;
+}
+
+static std::string pass() {
+    trace.clear();
+    schedulerRun();
+    return trace;
+}
+
+static void testPriorityOrder() {
+    reset();
+    schedulerAdd("net", taskNet, 0, 3, 1000);
+    schedulerAdd("ui", taskUi, 0, 1, 1000);
+    schedulerAdd("ir", taskIr, 0, 0, 50);
+
+    // lowest priority number first, ir polled before and after every task
+    std::string t = pass();
+    CHECK(t == "ir ui ir net ir", "priority order: [%s]", t.c_str());
+}
+
+static void testDeadlineOrder() {
+    reset();
+    schedulerAdd("ui", taskUi, 10, 2, 1000);
+    schedulerAdd("net", taskNet, 4, 2, 1000);
+
+    // both due on the first pass, registration order breaks the tie
+    std::string t = pass();
+    CHECK(t == "ui net", "first pass: [%s]", t.c_str());
+
+    // net (4 ms) is due again first; when both are due the earlier deadline runs first
+    mock_us += 5000;
+    t = pass();
+    CHECK(t == "net", "after 5 ms: [%s]", t.c_str());
+    mock_us += 5000;
+    t = pass();
+    CHECK(t == "net ui", "after 10 ms: [%s]", t.c_str());
+
+    // a task that is not due is skipped
+    t = pass();
+    CHECK(t.empty(), "nothing due: [%s]", t.c_str());
+}
+
+static void testYield() {
+    reset();
+    chunks_left = 5;
+    schedulerAdd("long", taskLong, 1000, 2, 1000);
+
+    // 1000 us budget at 400 us per chunk: three chunks per run
+    std::string t = pass();
+    CHECK(t == "long" && chunks_left == 2, "first run left %d chunks", chunks_left);
+    CHECK(sched_tasks[0].more, "task with work left is not marked");
+
+    // due again on the next pass although its period is 1 s
+    t = pass();
+    CHECK(t == "long" && chunks_left == 0, "second run left %d chunks", chunks_left);
+    t = pass();
+    CHECK(t.empty(), "finished task ran again: [%s]", t.c_str());
+}
+
+static void testOverruns() {
+    reset();
+    schedulerAdd("slow", taskSlow, 0, 1, 1000);
+    schedulerAdd("ui", taskUi, 0, 1, 1000);
+
+    for (int i = 0; i < 4; i++) pass();
+
+    CHECK(sched_tasks[0].runs == 4 && sched_tasks[0].overruns == 4, "slow: %u runs, %u overruns",
+        (unsigned int) sched_tasks[0].runs, (unsigned int) sched_tasks[0].overruns);
+    CHECK(sched_tasks[0].max_us == 3000, "slow: max %u us", (unsigned int) sched_tasks[0].max_us);
+    CHECK(sched_tasks[1].runs == 4 && sched_tasks[1].overruns == 0, "ui: %u runs, %u overruns",
+        (unsigned int) sched_tasks[1].runs, (unsigned int) sched_tasks[1].overruns);
+}
+
+static void testFallingBehind() {
+    reset();
+    schedulerAdd("ui", taskUi, 10, 1, 1000);
+    pass();
+
+    // a task stalled for many periods runs once, not once per missed period
+    mock_us += 100000;
+    std::string t = pass();
+    CHECK(t == "ui", "late pass: [%s]", t.c_str());
+    t = pass();
+    CHECK(t.empty(), "caught up instead of restarting: [%s]", t.c_str());
+    mock_us += 10000;
+    t = pass();
+    CHECK(t == "ui", "next period: [%s]", t.c_str());
+}
+
+static void testFull() {
+    reset();
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) CHECK(schedulerAdd("ui", taskUi, 0, 1, 1000), "task %d refused", i);
+    CHECK(!schedulerAdd("ui", taskUi, 0, 1, 1000), "task table overfilled");
+}
+
+int main() {
+    testPriorityOrder();
+    testDeadlineOrder();
+    testYield();
+    testOverruns();
+    testFallingBehind();
+    testFull();
+    return testResult();
+}
@@ -0,0 +1,140 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// TelnetSpy ring under a real concurrent producer
+//
+// one thread prints numbered lines as fast as it can while the main thread
+// runs handle() like loop() does. the ring overflows all the time, so the
+// client stream must consist of whole lines in increasing order, and every
+// place where lines went missing must carry a gap marker. a line may only
+// be cut short right before a gap marker (its tail was evicted while the
+// head was already on the wire). NUL keep-alives between writes are ignored.
+// a second run has the socket take only part of every write.
+
+#include "TelnetSpy.h"
+
+#include <thread>
+
+#define LINES                   200000
+#define LINE_FMT                "L%07ld-xxxxxxxxxxxxxxxxxxxxxxxxxx\n"
+#define LINE_LEN                36      // with the newline
+#define ACK_PER_MS              600
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { failures++; fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } } while (0)
+
+// one handle() per millisecond, the peer acks up to ACK_PER_MS meanwhile
+static void handleFor(TelnetSpy& spy, ClientState& client, unsigned long ms) {
+    for (unsigned long i = 0; i < ms; i++) {
+        mock_millis++;
+        client.window = ACK_PER_MS;
+        spy.handle();
+    }
+}
+
+// s is the beginning of some "L<n>-xxx..." line
+static bool linePrefix(const std::string& s) {
+    if (s.size() >= LINE_LEN) return false;
+    for (size_t i = 0; i < s.size(); i++) {
+        const char c = s[i];
+        if (i == 0 ? c != 'L' : i < 8 ? (c < '0' || c > '9') : i == 8 ? c != '-' : c != 'x') return false;
+    }
+    return true;
+}
+
+// checks the client stream, returns the number of lines seen
+static long checkStream(std::string sent) {
+    sent.erase(std::remove(sent.begin(), sent.end(), '\0'), sent.end());
+
+    long last = -1, lines = 0, gaps = 0;
+    bool after_gap = true;      // the stream starts on a line boundary
+    size_t pos = 0;
+
+    while (pos < sent.size()) {
+        const size_t eol = sent.find('\n', pos);
+        if (eol == std::string::npos) break;
+
+        if (sent.compare(pos, 3, "\r\n[") == 0) {
+            // "\r\n[N bytes dropped]\r\n"
+            unsigned int dropped = 0;
+            const size_t end = sent.find("]\r\n", pos);
+            CHECK(end != std::string::npos && sscanf(&sent[pos], "\r\n[%u bytes dropped]", &dropped) == 1 && dropped > 0,
+                "bad gap marker at %zu", pos);
+            if (end == std::string::npos) break;
+            pos = end + 3;
+            gaps++;
+            after_gap = true;
+            continue;
+        }
+
+        const std::string line = sent.substr(pos, eol + 1 - pos);
+        if (eol > pos && sent[eol - 1] == '\r' && sent.compare(eol + 1, 1, "[") == 0) {
+            // cut short by an eviction, must be the head of a real line
+            const std::string cut = sent.substr(pos, eol - 1 - pos);
+            CHECK(linePrefix(cut), "bad fragment '%s' at %zu", cut.c_str(), pos);
+            pos = eol - 1;
+            continue;
+        }
+
+        long n = -1;
+        CHECK(line.size() == LINE_LEN && sscanf(line.c_str(), "L%07ld-", &n) == 1 && line.compare(9, 26, "xxxxxxxxxxxxxxxxxxxxxxxxxx") == 0,
+            "bad line '%s' at %zu", line.c_str(), pos);
+        CHECK(n > last, "line %ld after %ld", n, last);
+        CHECK(n == last + 1 || after_gap, "lines %ld..%ld lost without a gap marker", last + 1, n - 1);
+        if (n > last) last = n;
+        lines++;
+        after_gap = false;
+        pos = eol + 1;
+    }
+
+    CHECK(last == LINES - 1, "last line %ld, expected %d", last, LINES - 1);
+    printf("%ld lines, %ld gap markers, last %ld\n", lines, gaps, last);
+    return lines;
+}
+
+static void stress(const char* name, size_t write_cap) {
+    printf("%s: ", name);
+
+    TelnetSpy spy;
+    spy.begin(115200);
+
+    ClientState client;
+    mock_pending_clients.push_back(&client);
+    handleFor(spy, client, 50);
+    CHECK(spy.getClientCount() == 1, "client not accepted");
+    client.sent.clear();
+    client.write_cap = write_cap;
+
+    std::atomic<bool> done{false};
+    std::thread producer([&]() {
+        for (long i = 0; i < LINES; i++) {
+            spy.printf(LINE_FMT, i);
+            if (i % 128 == 0) std::this_thread::yield();
+        }
+        done = true;
+    });
+    while (!done) handleFor(spy, client, 1);
+    producer.join();
+    handleFor(spy, client, 20000);
+
+    checkStream(client.sent);
+    CHECK(spy.getDroppedBytes() > 0, "ring never overflowed, the test proves nothing");
+}
+
+int main() {
+    stress("full writes", SIZE_MAX);
+    // every block is only partly taken, the rest must be sent next time
+    stress("short writes", 100);
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// pasted input larger than the receive buffer
+//
+// a client sends a block many times the size of recBuf at once. the app
+// reads only a few bytes per handle(), like the shell does, so recBuf is
+// full most of the time. every byte must still arrive, in order; what does
+// not fit has to stay in the client until there is room.
+
+#include "TelnetSpy.h"
+
+#define PASTE_LEN               1000
+#define READ_PER_PASS           32      // SHELL_CHUNK
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { failures++; fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } } while (0)
+
+int main() {
+    TelnetSpy spy;
+    spy.begin(115200);
+
+    ClientState client;
+    mock_pending_clients.push_back(&client);
+    for (int i = 0; i < 50; i++) {
+        mock_millis++;
+        spy.handle();
+    }
+    CHECK(spy.getClientCount() == 1, "client not accepted");
+    while (spy.available()) spy.read();
+
+    std::string paste;
+    for (int i = 0; i < PASTE_LEN; i++) paste += (char) ('a' + i % 26);
+    client.in.insert(client.in.end(), paste.begin(), paste.end());
+
+    std::string got;
+    for (int pass = 0; pass < 1000 && got.size() < paste.size(); pass++) {
+        mock_millis++;
+        spy.handle();
+        for (int i = 0; i < READ_PER_PASS && spy.available(); i++) got += (char) spy.read();
+    }
+
+    CHECK(got == paste, "received %zu of %zu bytes, first difference at %zu", got.size(), paste.size(),
+        (size_t) (std::mismatch(got.begin(), got.end(), paste.begin()).first - got.begin()));
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("%zu bytes pasted, all received\n", got.size());
+    return 0;
+}
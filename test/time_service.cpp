@@ -0,0 +1,121 @@
+/***************************************************************************
+Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+----------------------------------------------------------------------------
+This work is free. You can redistribute it and/or modify it under the
+terms of the Do What The Fuck You Want To Public License, Version 2,
+as published by Sam Hocevar. See the COPYING file for more details.
+****************************************************************************/
+
+// time service: pre-sync correction, monotonic clock, local time cache
+
+#include "firmware.h"
+
+#include <ctime>
+#include <sys/time.h>
+
+// the wall clock NTP would set, 0 => not synced
+static int64_t mock_epoch_offset_us = 0;
+
+static int mockGettimeofday(struct timeval* tv, void* tz) {
+    const int64_t now = mock_epoch_offset_us == 0 ? (int64_t) mock_us : (int64_t) mock_us + mock_epoch_offset_us;
+    tv->tv_sec = now / 1000000;
+    tv->tv_usec = now % 1000000;
+    return 0;
+}
+
+#define gettimeofday mockGettimeofday
+#include "time_service.h"
+#undef gettimeofday
+
+#define SYNC_EPOCH_S    1699999980LL        // 2023-11-14 22:13:00 UTC
+
+static void formatLocal(time_t sec, char* buf, size_t len) {
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void testBeforeSync() {
+    char text[TIME_TEXT_LEN];
+
+    mock_us = 5123456;
+    CHECK(timeNowUs() == 5123456, "uptime clock");
+    CHECK(timeCorrect(5123456) == 5123456, "corrected before the sync");
+    CHECK(strcmp(timeFormat(5123456, text, sizeof(text)), "000005.123") == 0, "uptime text [%s]", text);
+
+    // no NTP yet, nothing changes
+    timeRefresh();
+    CHECK(!time_synced, "synced without a wall clock");
+}
+
+static void testSync() {
+    char text[TIME_TEXT_LEN];
+    char expect[TIME_TEXT_LEN];
+
+    const uint64_t early = timeNowUs();     // captured at 5 s uptime
+
+    mock_us = 60000000;
+    mock_epoch_offset_us = SYNC_EPOCH_S * 1000000LL - (int64_t) mock_us;
+    timeRefresh();
+    CHECK(time_synced, "sync not picked up");
+
+    // the early stamp moves onto the wall clock, 55 s before the sync
+    CHECK(timeCorrect(early) == (uint64_t) (SYNC_EPOCH_S - 55) * 1000000ULL + 123456, "early stamp %llu", (unsigned long long) timeCorrect(early));
+    formatLocal(SYNC_EPOCH_S - 55, expect, sizeof(expect));
+    CHECK(strcmp(timeFormat(early, text, sizeof(text)), expect) == 0, "early stamp [%s], expected [%s]", text, expect);
+
+    // stamps taken after the sync are already epoch based
+    const uint64_t now = timeNowUs();
+    CHECK(now == (uint64_t) SYNC_EPOCH_S * 1000000ULL, "now %llu", (unsigned long long) now);
+    CHECK(timeCorrect(now) == now, "synced stamp corrected again");
+}
+
+static void testMonotonic() {
+    const uint64_t before = timeNowUs();
+
+    // NTP steps the clock back by 5 s
+    mock_us += 1000000;
+    mock_epoch_offset_us -= 5000000;
+    timeRefresh();
+    CHECK(timeNowUs() >= before, "clock went backwards");
+
+    // and it moves again once the wall clock has caught up
+    mock_us += 10000000;
+    CHECK(timeNowUs() > before, "clock stuck");
+}
+
+// every second of the cached minute and the ones around it
+static void checkMinute(const char* tz, time_t start) {
+    char text[TIME_TEXT_LEN];
+    char expect[TIME_TEXT_LEN];
+
+    setenv("TZ", tz, 1);
+    tzset();
+
+    mock_epoch_offset_us = (int64_t) (start + 30) * 1000000LL - (int64_t) mock_us;
+    timeRefresh();
+    CHECK(time_cache_s == start + 30, "cache not at %lld", (long long) (start + 30));
+
+    for (time_t sec = start - 5; sec < start + 65; sec++) {
+        formatLocal(sec, expect, sizeof(expect));
+        timeFormat((uint64_t) sec * 1000000ULL, text, sizeof(text));
+        CHECK(strcmp(text, expect) == 0, "%s %lld: [%s], expected [%s]", tz, (long long) sec, text, expect);
+    }
+}
+
+static void testLocalCache() {
+    checkMinute("UTC0", SYNC_EPOCH_S + 120);
+    // the minutes before and after a DST switch (2023-11-05 06:00 UTC)
+    checkMinute("EST5EDT,M3.2.0,M11.1.0", 1699164000 - 60);
+    checkMinute("EST5EDT,M3.2.0,M11.1.0", 1699164000);
+    // half hour zone
+    checkMinute("IST-5:30", SYNC_EPOCH_S);
+}
+
+int main() {
+    testBeforeSync();
+    testSync();
+    testMonotonic();
+    testLocalCache();
+    return testResult();
+}
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+# Copyright © 2023 Shell M. Shrader <shell at shellware dot com>
+# ----------------------------------------------------------------------------
+# This work is free. You can redistribute it and/or modify it under the
+# terms of the Do What The Fuck You Want To Public License, Version 2,
+# as published by Sam Hocevar. See the COPYING file for more details.
+
+"""render the binary log of a -D LOG_BINARY build (see src/binlog.h)
+
+usage:
+    nc lolin-ir-blaster.local 23 | tools/log_decoder.py .pio/build/d1_mini/firmware.elf
+    tools/log_decoder.py -t firmware.elf capture.bin
+
+the ELF must be the one the device is running. use a raw connection (nc),
+a telnet client would interpret 0xff bytes inside the records.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MARK = 0x1E
+SHT_NOBITS = 8
+
+SPEC = re.compile(rb"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|z|j|t|L)?([diouxXcsfFeEgGp%])")
+
+
+class Elf:
+    """just enough ELF32 to read strings by address"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            sys.exit(f"{path}: not an ELF32 file")
+        endian = "<" if self.data[5] == 1 else ">"
+        shoff, = struct.unpack_from(endian + "I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from(endian + "HH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, _, addr, offset, size = struct.unpack_from(endian + "IIIIII", self.data, shoff + i * shentsize)
+            if addr != 0 and sh_type != SHT_NOBITS:
+                self.sections.append((addr, offset, size))
+        self.cache = {}
+
+    def string(self, addr):
+        if addr not in self.cache:
+            text = None
+            for base, offset, size in self.sections:
+                if base <= addr < base + size:
+                    start = offset + addr - base
+                    end = self.data.find(b"\0", start, offset + size)
+                    text = self.data[start:end if end >= 0 else offset + size]
+                    break
+            self.cache[addr] = text
+        return self.cache[addr]
+
+
+def render(fmt, args):
+    """printf on the host -- the C format string with the captured values"""
+    out = []
+    pos = 0
+    values = iter(args)
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == b"%":
+            out.append(b"%")
+            continue
+        if width == b"*":
+            width = str(next(values, (None, 0))[1]).encode()
+        if prec == b"*":
+            prec = str(next(values, (None, 0))[1]).encode()
+        tag, value = next(values, (None, None))
+        if value is None:
+            out.append(b"<?>")
+            continue
+        spec = b"%" + flags + (width or b"") + (b"." + prec if prec is not None else b"")
+        if conv in b"di":
+            if tag == "i":
+                value = struct.unpack("<i", struct.pack("<I", value & 0xFFFFFFFF))[0]
+            elif tag == "l":
+                value = struct.unpack("<q", struct.pack("<Q", value & 0xFFFFFFFFFFFFFFFF))[0]
+            out.append((spec + b"d") % value)
+        elif conv in b"ouxX":
+            out.append((spec + (b"d" if conv == b"u" else conv)) % int(value))
+        elif conv == b"p":
+            out.append(b"0x%x" % int(value))
+        elif conv == b"c":
+            out.append(bytes([int(value) & 0xFF]))
+        elif conv == b"s":
+            out.append((spec + b"s") % (value if isinstance(value, bytes) else str(value).encode()))
+        else:
+            out.append((spec + conv) % float(value))
+    out.append(fmt[pos:])
+    return b"".join(out)
+
+
+class Decoder:
+    def __init__(self, elf, stamps, out):
+        self.elf = elf
+        self.stamps = stamps
+        self.out = out
+        self.buf = bytearray()
+
+    def feed(self, data):
+        self.buf += data
+        while self.buf:
+            mark = self.buf.find(MARK)
+            if mark != 0:
+                text = self.buf if mark < 0 else self.buf[:mark]
+                # TelnetSpy pings are NUL bytes
+                self.out.write(bytes(text).replace(b"\0", b""))
+                del self.buf[:len(text)]
+                continue
+            used = self.record()
+            if used == 0:
+                return
+            del self.buf[:used]
+        self.out.flush()
+
+    def record(self):
+        """decodes one record at the start of buf, returns its length or 0 if incomplete"""
+        b = self.buf
+        if len(b) < 10:
+            return 0
+        argc = b[1]
+        fmt_id, ts = struct.unpack_from("<II", b, 2)
+        pos = 10
+        args = []
+        for _ in range(argc):
+            if pos >= len(b):
+                return 0
+            tag = chr(b[pos])
+            pos += 1
+            if tag == "i":
+                size, value = 4, (lambda p: struct.unpack_from("<I", b, p)[0])
+            elif tag == "l":
+                size, value = 8, (lambda p: struct.unpack_from("<Q", b, p)[0])
+            elif tag == "d":
+                size, value = 8, (lambda p: struct.unpack_from("<d", b, p)[0])
+            elif tag == "s":
+                if pos + 2 > len(b):
+                    return 0
+                size = 2 + struct.unpack_from("<H", b, pos)[0]
+                value = (lambda p: bytes(b[p + 2:p + size]))
+            else:
+                # not a record after all -- pass the mark through as text
+                self.out.write(b[:1])
+                return 1
+            if pos + size > len(b):
+                return 0
+            args.append((tag, value(pos)))
+            pos += size
+
+        fmt = self.elf.string(fmt_id)
+        if fmt is None:
+            text = b"<unknown format 0x%08x> %r\n" % (fmt_id, [a[1] for a in args])
+        else:
+            text = render(fmt, args)
+        if self.stamps:
+            text = b"[%6u.%06u] " % (ts // 1000000, ts % 1000000) + text.lstrip(b"\r\n")
+        self.out.write(text)
+        return pos
+
+
+def main():
+    parser = argparse.ArgumentParser(description="render the binary log of a LOG_BINARY build")
+    parser.add_argument("elf", help="firmware ELF the device is running")
+    parser.add_argument("capture", nargs="?", help="captured log (default: stdin)")
+    parser.add_argument("-t", "--timestamps", action="store_true", help="prefix records with their device timestamp")
+    opts = parser.parse_args()
+
+    decoder = Decoder(Elf(opts.elf), opts.timestamps, sys.stdout.buffer)
+    src = open(opts.capture, "rb") if opts.capture else sys.stdin.buffer
+    with src:
+        while True:
+            data = src.read1(4096) if hasattr(src, "read1") else src.read(4096)
+            if not data:
+                break
+            decoder.feed(data)
+
+
+if __name__ == "__main__":
+    main()